@@ -8,6 +8,40 @@ void slash_completer_revert_skip(struct slash *slash, char * orig_slash_buffer);
 void slash_complete(struct slash * slash);
 void slash_path_completer(struct slash * slash, char * token);
 void slash_watch_completer(struct slash * slash, char * token);
+void slash_timeout_completer(struct slash * slash, char * token);
 void slash_help_completer(struct slash *slash, char * token);
 
+/**
+ * Completer of a command whose candidates are slow to get, for example from a remote node.
+ *
+ * fetch() gets the command line and writes the candidates for its last word to words, each one
+ * terminated by '\0', and returns their number or a negative error. When slash is built with
+ * async, it runs on a thread of its own and must not use the slash instance: the line editor
+ * stays responsive, and completes the line when the candidates arrive. The candidates are kept
+ * for the same line, so the next Tab completes right away. A failed fetch rings the bell and is
+ * tried again on the next Tab.
+ *
+ * The thread holds a reference on the APM providing fetch() until it returns, so a dlclose() of
+ * the APM meanwhile only unloads it afterwards, while slash_list_synchronize() does not wait for
+ * the fetch. The completer must be in the same APM as fetch(), and otherwise stay valid for as
+ * long as the instance, its address is the key of the cached candidates.
+ */
+#define SLASH_ASYNC_RESULT_SIZE 4096
+struct slash_async_completer {
+	int (*fetch)(const char *line, char *words, size_t size, unsigned int timeout_ms);
+	/* Time given to fetch(), and how long its candidates are kept, 0 for the defaults */
+	unsigned int timeout_ms;
+	unsigned int ttl_ms;
+};
+
+/**
+ * @brief Complete from the candidates of an asynchronous completer, to call from the completer of the command
+ *
+ * static const struct slash_async_completer param_completer = {.fetch = param_fetch};
+ * static void param_complete(struct slash *slash, char *token) {
+ *     slash_complete_async(slash, token, &param_completer);
+ * }
+ */
+void slash_complete_async(struct slash *slash, char *token, const struct slash_async_completer *completer);
+
 #endif // SLASH_COMPLETER_H
\ No newline at end of file
@@ -9,6 +9,7 @@
 #define _OPTPARSE_H
 
 #include <stdio.h>
+#include <stddef.h>
 
 typedef struct optparse optparse_t;
 typedef struct optparse_opt optparse_opt_t;
@@ -32,12 +33,52 @@ optparse_t *optparse_new(const char *progname, const char *arg_summary);
  */
 optparse_t *optparse_new_ex(const char *progname, const char *arg_summary, const char *help);
 
+/* Storage needed by optparse_new_arena() for a parser with nopts options */
+#define OPTPARSE_PARSER_SIZE (24 * sizeof(void *) + 512)
+#define OPTPARSE_OPT_SIZE (12 * sizeof(void *))
+#define OPTPARSE_ARENA_SIZE(nopts) (OPTPARSE_PARSER_SIZE + (nopts) * (OPTPARSE_OPT_SIZE + sizeof(void *)) + 32)
+
+/**
+ * @brief Create a new option parser context in caller provided storage, without using the heap
+ *
+ * The storage can be slash_alloc() memory or a buffer on the stack, for a parser used once, or a static
+ * buffer for a parser which is set up once and reused with optparse_reset(). optparse_del() is not needed,
+ * but harmless.
+ *
+ * @param buf storage for the parser and its options, at least OPTPARSE_ARENA_SIZE(number of options) bytes
+ * @param size size of buf
+ * @param progname name to be associated with the option parser
+ * @param arg_summary short list of optional command line options and arguments, can be NULL if not relevant
+ * @param help longer description of the command, can be NULL if not relevant.
+ * @return pointer to new context, NULL if buf is too small
+ * @warning the progname, arg_summary and help arguments, if not NULL, must be valid for the entire lifecycle of the option parser!
+ */
+optparse_t *optparse_new_arena(void *buf, size_t size, const char *progname, const char *arg_summary, const char *help);
+
+/**
+ * @brief Clear the parsed state of an option parser, so it can parse a new command line with the same options
+ * @param parser pointer to valid option parser
+ */
+void optparse_reset(optparse_t *parser);
+
 /**
  * @brief Release the memory for the given option parser object
  * @param parser pointer to valid option parser obtained by calling optparse_new() or optparse_new_ex()
  */
 void optparse_del(optparse_t *parser);
 
+/**
+ * @brief Parse the options of a command line
+ *
+ * Options are found through an index built by the first parse after options were added, so the lookup
+ * does not depend on the number of options. Long options can be abbreviated, as long as the
+ * abbreviation is unambiguous, "--verb" for "--verbose" for example.
+ *
+ * @param parser pointer to valid option parser
+ * @param argc number of arguments
+ * @param argv arguments, not including the command name
+ * @return index of the first non option argument, -1 on error
+ */
 int optparse_parse(optparse_t *parser, int argc, const char *argv[]);
 void optparse_help(optparse_t *parser, FILE *fp);
 
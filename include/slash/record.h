@@ -0,0 +1,63 @@
+#ifndef SLASH_RECORD_H
+#define SLASH_RECORD_H
+
+#include <stdint.h>
+#include <slash/slash.h>
+
+/**
+ * Session recording and timed replay, to load test command handlers with real operator traffic.
+ *
+ * A recording holds the raw keystrokes read by slash_readline() and the lines executed by
+ * slash_execute(), with their time since the start of the recording. The replay feeds the
+ * keystrokes (or the lines, when no keystrokes were recorded) through a pipe to the fd_read
+ * of a separate slash instance, so it works headless, and measures every command.
+ *
+ * File layout: a struct slash_record_header, then struct slash_record_event entries,
+ * each followed by len bytes of data.
+ */
+
+#define SLASH_RECORD_MAGIC 0x43524c53 /* "SLRC" in little endian */
+#define SLASH_RECORD_VERSION 1
+
+enum slash_record_type {
+	SLASH_RECORD_KEYS = 1,
+	SLASH_RECORD_LINE = 2,
+};
+
+struct slash_record_header {
+	uint32_t magic;
+	uint32_t version;
+};
+
+struct slash_record_event {
+	uint64_t time_ns;
+	uint32_t type;
+	uint32_t len;
+};
+
+/**
+ * @brief Start recording the keystrokes and executed lines of a slash instance.
+ * @return 0 on success, -1 on failure
+ */
+int slash_record_start(struct slash *slash, const char *path);
+
+/**
+ * @brief Stop recording and close the recording file.
+ */
+void slash_record_stop(struct slash *slash);
+
+/**
+ * @brief Replay a recording and print the throughput and the latency of each command.
+ *
+ * @param slash slash instance used to print the report, the recording is replayed in a new instance
+ * @param path recording file
+ * @param speed 1 for the recorded pace, N for N times faster, 0 for as fast as possible
+ * @return number of commands executed, -1 on failure
+ */
+int slash_replay(struct slash *slash, const char *path, unsigned int speed);
+
+/* Called by slash_readline() and slash_execute() while recording */
+void slash_record_keys(struct slash *slash, const char *keys, size_t len);
+void slash_record_line(struct slash *slash, const char *line);
+
+#endif // SLASH_RECORD_H
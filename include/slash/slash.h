@@ -26,6 +26,7 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <slash_config.h>
 
@@ -44,7 +45,7 @@
 #define slash_max(a, b) ((a) > (b) ? (a) : (b))
 #define slash_min(a, b) ((a) < (b) ? (a) : (b))
 
-#define __slash_command(_ident, _name, _func, _completer, _args, _help) 	\
+#define __slash_command_opts(_ident, _name, _func, _completer, _args, _help, _opts) 	\
 	__attribute__((section("slash")))\
 	__attribute__((aligned(4)))\
 	__attribute__((used))\
@@ -56,8 +57,12 @@
 		.help = _help, \
         .next = {NULL},  /* Next pointer in case the user wants to implement custom ordering within or across APMs.
 							It should not required by the default implementation. */\
+		.opts = _opts,\
 	};
 
+#define __slash_command(_ident, _name, _func, _completer, _args, _help) 	\
+	__slash_command_opts(_ident, _name, _func, _completer, _args, _help, NULL)
+
 #define slash_command(_name, _func, _args, _help)			\
 	__slash_command(slash_cmd_ ## _name,				\
 			#_name, _func, NULL, _args, _help)
@@ -82,6 +87,27 @@
 	__slash_command(slash_cmd_ ## _group ## _ ## _subgroup ## _name, \
 			#_group" "#_subgroup" "#_name, _func, _completer, _args, _help)
 
+/* Commands with an option schema, see struct slash_opt */
+#define slash_command_opts(_name, _func, _completer, _args, _help, _opts)	\
+	__slash_command_opts(slash_cmd_ ## _name,				\
+			#_name, _func, _completer, _args, _help, _opts)
+
+#define slash_command_sub_opts(_group, _name, _func, _completer, _args, _help, _opts)	\
+	__slash_command_opts(slash_cmd_##_group ## _ ## _name ,		\
+			#_group" "#_name, _func, _completer, _args, _help, _opts)
+
+#define slash_command_subsub_opts(_group, _subgroup, _name, _func, _completer, _args, _help, _opts) \
+	__slash_command_opts(slash_cmd_ ## _group ## _ ## _subgroup ## _name, \
+			#_group" "#_subgroup" "#_name, _func, _completer, _args, _help, _opts)
+
+
+/* Use once in an APM: references the bounds of its "slash" section, so the linker
+ * defines and exports __start_slash and __stop_slash for slash_init_apm() */
+#define SLASH_APM_SECTION_INIT()					\
+	extern struct slash_command __start_slash __attribute__((weak));	\
+	extern struct slash_command __stop_slash __attribute__((weak));	\
+	__attribute__((used))						\
+	struct slash_command * const slash_apm_section_bounds[2] = {&__start_slash, &__stop_slash};
 
 #define slash_command_group(_name, _help)
 
@@ -109,6 +135,56 @@ typedef void (*slash_completer_func_t)(struct slash *slash, char * token);
 #define SLASH_ENOMEM	(-5)
 #define SLASH_ENOENT	(-6)
 #define SLASH_EBREAK	(-7)
+#define SLASH_ETIMEDOUT	(-8)
+
+/* Option schema
+ *
+ * A const table of options, terminated by SLASH_OPT_END, describing the options of a command.
+ * slash_opts_parse() stores the parsed values in the members of a caller struct, help prints
+ * the options and the completer completes the long option names, all from the table:
+ *
+ *   struct watch_opts { unsigned int interval; };
+ *   static const struct slash_opt watch_opts[] = {
+ *       SLASH_OPT_UNSIGNED('n', "interval", "NUM", struct watch_opts, interval, "interval in milliseconds"),
+ *       SLASH_OPT_END,
+ *   };
+ */
+enum slash_opt_type {
+	SLASH_OPT_TYPE_FLAG,
+	SLASH_OPT_TYPE_INT,
+	SLASH_OPT_TYPE_UNSIGNED,
+	SLASH_OPT_TYPE_DOUBLE,
+	SLASH_OPT_TYPE_STRING,
+};
+
+struct slash_opt {
+	int short_opt;
+	const char *long_opt;
+	/* Name of the argument in the help, NULL for flags */
+	const char *arg_desc;
+	enum slash_opt_type type;
+	/* Offset of the value in the caller struct */
+	size_t offset;
+	/* Value stored by a flag */
+	int value;
+	const char *help;
+};
+
+#define __slash_opt(_short, _long, _arg, _type, _struct, _member, _value, _help) \
+	{ .short_opt = _short, .long_opt = _long, .arg_desc = _arg, .type = _type, \
+	  .offset = offsetof(_struct, _member), .value = _value, .help = _help }
+
+#define SLASH_OPT_FLAG(_short, _long, _struct, _member, _value, _help) \
+	__slash_opt(_short, _long, NULL, SLASH_OPT_TYPE_FLAG, _struct, _member, _value, _help)
+#define SLASH_OPT_INT(_short, _long, _arg, _struct, _member, _help) \
+	__slash_opt(_short, _long, _arg, SLASH_OPT_TYPE_INT, _struct, _member, 0, _help)
+#define SLASH_OPT_UNSIGNED(_short, _long, _arg, _struct, _member, _help) \
+	__slash_opt(_short, _long, _arg, SLASH_OPT_TYPE_UNSIGNED, _struct, _member, 0, _help)
+#define SLASH_OPT_DOUBLE(_short, _long, _arg, _struct, _member, _help) \
+	__slash_opt(_short, _long, _arg, SLASH_OPT_TYPE_DOUBLE, _struct, _member, 0, _help)
+#define SLASH_OPT_STRING(_short, _long, _arg, _struct, _member, _help) \
+	__slash_opt(_short, _long, _arg, SLASH_OPT_TYPE_STRING, _struct, _member, 0, _help)
+#define SLASH_OPT_END { .short_opt = 0, .long_opt = NULL }
 
 /* Command struct */
 struct slash_command {
@@ -132,6 +208,9 @@ struct slash_command {
 	/* Optional context pointer (after `next` for ABI compatibility).
 		Will be supplied to `func_ctx` if specified.  */
 	void *context;
+	/* Optional option schema (after `context` for ABI compatibility).
+		Used by slash_opts_parse(), help and completion. */
+	const struct slash_opt *opts;
 };
 
 /* Slash context */
@@ -189,14 +268,109 @@ struct slash {
 	 * for instance, typing: "w<TAB>g<TAB>s<TAB>" would result in the completed command line "watch get serial0" in 6 keystrokes
 	 */
 	bool complete_in_completion;
+
+	/* Scratch memory, see slash_alloc() */
+	char *arena;
+	size_t arena_size;
+	size_t arena_used;
+	int arena_depth;
+	bool arena_owned;
+	struct slash_arena_chunk *arena_chunks;
+
+	/* Variables expanded by slash_execute(), see slash_var_set() */
+	struct slash_vars *vars;
+
+	/* Index of the command names for fuzzy completion */
+	struct slash_fuzzy_index *fuzzy;
+
+	/* Candidates of the last Tab, reused by the next one */
+	struct slash_completion *completion;
+
+	/* Results and jobs of asynchronous completers, see slash_complete_async() */
+	struct slash_async *async;
+
+	/* Listing of the commands printed by help */
+	struct slash_help *help;
+
+	/* Index of the words of the commands searched by apropos */
+	struct slash_apropos *apropos;
+
+	/* Command names suggested for unknown commands */
+	struct slash_suggest *suggest;
+
+	/* History entries by prefix, for the hint shown after the line */
+	struct slash_autosuggest *autosuggest;
+
+	/* Entries of the history by digest when they are kept unique, see slash_set_history_unique() */
+	struct slash_history_unique *history_unique;
+
+	/* Session recording, see slash_record_start(), always NULL without -Drecord=true */
+	struct slash_recorder *record;
+
+	/* The arguments as typed, before they were split into argv, starting after the command name */
+	const char *args;
+
+	/* CLOCK_MONOTONIC deadline of the executing command, 0 for none, see slash_should_abort() */
+	uint64_t deadline_ns;
+	unsigned int timeout_ms;
+	/* The executing command was told that its deadline had passed */
+	bool deadline_seen;
+	/* Deadline of the command executing the current one, see slash_timeout_nested() */
+	uint64_t deadline_outer;
+	/* The deadline of the executing command is the default one */
+	bool deadline_default;
+	/* The next command gets the deadline set by timeout instead of the default one */
+	bool deadline_explicit;
+
+	/* Size the line buffer may grow to, see slash_set_line_max() */
+	size_t line_max;
+	bool line_owned;
+	/* Length of the gap at the cursor while editing in the middle of the line, 0 when the line is contiguous */
+	size_t gap;
+
+	/* Pasted lines returned by the next calls to slash_readline() */
+	char *paste;
+	size_t paste_next;
+	size_t paste_after;
+	/* Bracketed paste was turned on by slash_configure_term(), and is turned off when restoring */
+	bool paste_mode;
 };
 
 /**
  * @brief Initializes an APM using slash.
- * 
+ *
+ * Registers all commands in the "slash" section of the APM in one batch.
+ * The APM must export the __start_slash and __stop_slash symbols of its section.
+ *
+ * Like slash_init_apm_lazy(), only provided when the platform has dlopen() and dlinfo()
+ * (SLASH_HAVE_APM in slash_config.h), which an embedded build usually has not.
+ *
  * @param handle Dynamic linking handle to the APM.
+ * @return number of commands registered, -1 on failure
+ */
+int slash_init_apm(void * handle);
+
+/**
+ * @brief Register the commands of an APM, deferring dlopen() until one of them is invoked.
+ *
+ * If the cache file holds the command names of the APM (and is newer than it),
+ * only name stubs are registered. The first time one of the stubs is executed, the APM
+ * is loaded, slash_on_apm_load_hook() is called and the stubs are replaced by the real commands.
+ * Otherwise the APM is loaded right away and the cache is written for the next time.
+ *
+ * @param path path of the APM to dlopen()
+ * @param cache_path file holding the command names of the APM
+ * @return number of commands registered, -1 on failure
+ */
+int slash_init_apm_lazy(const char * path, const char * cache_path);
+
+/**
+ * @brief Implement this function to initialize an APM loaded by slash_init_apm_lazy()
+ *
+ * @param path path of the loaded APM
+ * @param handle dynamic linking handle to the APM
  */
-void slash_init_apm(void * handle);
+void slash_on_apm_load_hook(const char * path, void * handle);
 
 struct slash *slash_create(size_t line_size, size_t history_size);
 
@@ -204,6 +378,48 @@ void slash_create_static(struct slash *slash, char * line_buf, size_t line_size,
 
 void slash_destroy(struct slash *slash);
 
+/**
+ * @brief Release what an instance made with slash_create_static() allocated while in use
+ *
+ * The line and history buffers, and the arena given to slash_set_arena(), belong to the caller
+ * and are left alone.
+ */
+void slash_destroy_static(struct slash *slash);
+
+/**
+ * @brief Let the line buffer grow past the line_size given to slash_create()
+ *
+ * The buffer is doubled when the line fills it, up to line_max bytes. The buffer given to
+ * slash_create_static() does not grow.
+ *
+ * @return SLASH_SUCCESS, or SLASH_EINVAL if line_max is below the current size or the buffer cannot grow
+ */
+int slash_set_line_max(struct slash *slash, size_t line_max);
+
+/* Suggested arena size for a given line size, allocated by slash_create() */
+#define SLASH_ARENA_SIZE(line_size) (4 * (line_size) + 4096)
+
+/**
+ * @brief Give slash_alloc() a buffer, typically for an instance made with slash_create_static()
+ *
+ * Without a buffer, every slash_alloc() uses the heap.
+ *
+ * @param buf storage for the arena, SLASH_ARENA_SIZE(line_size) bytes is plenty for the builtins
+ * @param size size of buf
+ */
+void slash_set_arena(struct slash *slash, void *buf, size_t size);
+
+/**
+ * @brief Allocate scratch memory, released when the command being executed returns
+ *
+ * Memory is taken from the arena of the instance, and only from the heap when the arena is full,
+ * so command handlers can use it instead of large stack buffers or malloc()/free().
+ * Nested commands (watch, run) release only their own allocations.
+ *
+ * @return memory aligned for any type, NULL if out of memory
+ */
+void *slash_alloc(struct slash *slash, size_t size);
+
 char *slash_readline(struct slash *slash);
 
 void slash_sigint(struct slash *slash, int signum);
@@ -255,12 +471,66 @@ extern slash_completer_func_t slash_global_completer;
 
 int slash_execute(struct slash *slash, char *line);
 
+/**
+ * @brief Set a variable of the instance
+ *
+ * slash_execute() replaces $NAME and ${NAME} with the value of the variable, or of the environment
+ * variable NAME, except between single quotes. Unknown names are left as they are.
+ *
+ * @param name letters, digits and underscores, not starting with a digit
+ * @return SLASH_SUCCESS, SLASH_EINVAL for an invalid name or SLASH_ENOMEM
+ */
+int slash_var_set(struct slash *slash, const char *name, const char *value);
+
+/**
+ * @return SLASH_SUCCESS, or SLASH_ENOENT if the variable is not set
+ */
+int slash_var_unset(struct slash *slash, const char *name);
+
+/**
+ * @return value of the variable or environment variable, NULL if it is not set
+ */
+const char *slash_var_get(struct slash *slash, const char *name);
+
 int slash_loop(struct slash *slash);
 
 int slash_wait_interruptible(struct slash *slash, unsigned int ms);
 
 int slash_set_wait_interruptible(struct slash *slash, slash_waitfunc_t waitfunc);
 
+/**
+ * @brief Set the time budget of every command, 0 for none
+ *
+ * A command which returns after slash_should_abort(), slash_remaining_ms() or
+ * slash_wait_interruptible() reported its deadline returns SLASH_ETIMEDOUT. A command which
+ * overran its deadline without checking it keeps its return value, and the overrun is printed.
+ * The budget is given to the commands which do the work: commands executing other ones (run,
+ * watch, prun, timeout) call slash_timeout_nested(), and each command they execute gets its own.
+ * A command run by `timeout <ms>` gets that deadline instead. Commands executed by another command
+ * get at most the time left to the outer one.
+ */
+void slash_set_timeout(struct slash *slash, unsigned int ms);
+
+/**
+ * @brief Give the default deadline to the commands executed by the executing one, rather than to itself
+ *
+ * To call at the start of a command which executes other commands, so a script or a loop is not
+ * stopped by the budget of a single command. A deadline given by timeout or by an outer command stays.
+ */
+void slash_timeout_nested(struct slash *slash);
+
+/**
+ * @brief Check if the executing command should stop, because of Ctrl-C or its deadline
+ *
+ * Cheap enough to call in every iteration of a long loop.
+ */
+bool slash_should_abort(struct slash *slash);
+
+/**
+ * @return milliseconds left to the deadline of the executing command, -1 if there is none
+ */
+int slash_remaining_ms(struct slash *slash);
+
 int slash_printf(struct slash *slash, const char *format, ...);
 
 int slash_getopt(struct slash *slash, const char *optstring);
@@ -288,20 +558,117 @@ int slash_prompt(struct slash * slash);
 
 void slash_command_description(struct slash *slash, struct slash_command *command);
 
+/**
+ * @brief Parse the options of the executing command from an option schema, without allocating.
+ *
+ * Options are "-c VALUE", "-cVALUE", "--long=VALUE" and "--long", long options may be abbreviated
+ * when unambiguous and flags may be combined ("-ab"). Parsing stops at "--" or the first argument which
+ * is not an option. "-h" and "--help" are reported as an error, unless the schema uses them.
+ *
+ * @param slash slash context of the executing command
+ * @param opts option schema, terminated by SLASH_OPT_END
+ * @param values struct receiving the option values, members of options not given are left untouched
+ * @return index in slash->argv of the first non option argument, -1 on error or help,
+ * the command should then return SLASH_EUSAGE to print its usage and options
+ */
+int slash_opts_parse(struct slash *slash, const struct slash_opt *opts, void *values);
+
+/**
+ * @brief Print the options of an option schema, as listed by help.
+ */
+void slash_opts_help(struct slash *slash, const struct slash_opt *opts);
+
 int slash_run(struct slash *slash, char * filename, int printcmd);
 
 void slash_history_add(struct slash *slash, char *line);
 
+/**
+ * @brief Keep each line once in the history
+ *
+ * A line executed again is moved to the end of the history instead of being stored twice,
+ * so the same few commands repeated do not push everything else out of the history.
+ *
+ * @param unique true to remove older copies of the lines added, false to keep them (the default)
+ * @return SLASH_SUCCESS, or SLASH_ENOMEM
+ */
+int slash_set_history_unique(struct slash *slash, bool unique);
+
+struct slash_list_snapshot;
+
 typedef struct slash_list_iterator_s {
 	struct slash_command * element;
+	struct slash_list_snapshot * snapshot;
+	size_t index;
 } slash_list_iterator;
 
+/**
+ * @brief Iterate the command list in alphabetical order.
+ *
+ * The iterator walks the snapshot of the list that was current at the first call. Any add or
+ * remove frees a snapshot once its readers are gone, so when the list may be modified by another
+ * thread, the iteration must be done between slash_list_read_lock() and slash_list_read_unlock().
+ * slash_list_find_name() takes the read lock itself, but the command found may be removed
+ * (APM unload) unless the caller holds it too.
+ */
 struct slash_command * slash_list_iterate(slash_list_iterator * iterator);
 struct slash_command * slash_list_find_name(const char * name);
+struct slash_command * slash_list_find_name_len(const char * name, size_t len);
 int slash_list_add(struct slash_command * item);
 int slash_list_remove(const struct slash_command * item);
+
+/**
+ * @brief Add an array of commands in a single batch, visible to readers at once.
+ * @return number of commands which replaced an existing command with the same name, -1 on failure
+ */
+int slash_list_add_batch(struct slash_command * const * items, size_t count);
+
+/**
+ * @brief Add all commands in a section in a single batch, visible to readers at once.
+ *
+ * @param start first command in the section (e.g. &__start_slash)
+ * @param stop end of the section (e.g. &__stop_slash)
+ * @return number of commands added, -1 on failure
+ */
+int slash_list_add_section(struct slash_command * start, struct slash_command * stop);
+
+/**
+ * @brief Remove all commands in a section in a single batch.
+ * @return 0 on success, -1 on failure
+ */
+int slash_list_remove_section(struct slash_command * start, struct slash_command * stop);
+
+/**
+ * @brief Step to the next command in a section, taking the platform specific storage size into account.
+ */
+struct slash_command * slash_list_section_next(struct slash_command * cmd);
 int slash_list_init(void);
 
+/**
+ * @brief Enter a read-side section of the command list.
+ *
+ * Commands found or iterated inside the section stay valid until slash_list_read_unlock(),
+ * even if they are removed meanwhile. Sections are cheap (no mutex) and may be nested.
+ */
+void slash_list_read_lock(void);
+void slash_list_read_unlock(void);
+
+/**
+ * @brief Wait until no reader can reference removed commands, e.g. before dlclose() of an APM.
+ *
+ * Only this function waits for the readers: adding and removing commands never blocks, the
+ * snapshots they replace are freed by a later writer once the readers have left.
+ * slash_execute() runs a command inside a read-side section, so a command must not call this
+ * function (it returns -1) nor unload its own APM: unload from another thread, or after the
+ * command has returned.
+ * @return 0 on success, -1 if called from inside a read-side section
+ */
+int slash_list_synchronize(void);
+
+/**
+ * @brief Get a counter which changes every time the command list is modified.
+ */
+unsigned int slash_list_generation(void);
+
 /**
  * @brief let slash handle stdout/stdin
  * @param slash pointer to valid slash instance
@@ -0,0 +1,98 @@
+#ifndef SLASH_STATS_H
+#define SLASH_STATS_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <slash/slash.h>
+
+/**
+ * Per command latency histograms in a shared memory segment.
+ *
+ * slash_execute() records the duration of every command in a log bucket histogram, using relaxed
+ * atomics only. An external monitor (tools/slash_stats.c) maps the segment read only and samples
+ * the histograms at any rate, without any contention with the shell.
+ *
+ * Bucket b < 2^SLASH_STATS_SUB_BITS holds durations of b ns. Above that, every power of two
+ * is split in 2^SLASH_STATS_SUB_BITS sub buckets, so a bucket is never wider than 1/8 of its value.
+ */
+
+#define SLASH_STATS_MAGIC 0x534c5354 /* "SLST" */
+#define SLASH_STATS_VERSION 2
+
+#define SLASH_STATS_NAME_SIZE 48
+#define SLASH_STATS_SUB_BITS 3
+/* Durations of 2^SLASH_STATS_MAX_EXP ns (~73 minutes) and more go in the last bucket */
+#define SLASH_STATS_MAX_EXP 42
+#define SLASH_STATS_BUCKETS ((SLASH_STATS_MAX_EXP - SLASH_STATS_SUB_BITS + 1) << SLASH_STATS_SUB_BITS)
+
+/* Layout of the segment, any change must increment SLASH_STATS_VERSION */
+struct slash_stats_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t entry_size;
+	uint32_t max_entries;
+	uint32_t bucket_count;
+	uint32_t sub_bits;
+	int32_t pid;
+	/* Number of entries in use, entries are only ever added */
+	_Atomic uint32_t entry_count;
+	/* Commands executed but not recorded, as all max_entries entries were in use */
+	_Atomic uint32_t overflow;
+};
+
+struct slash_stats_entry {
+	/* Set (release) once the name is written, the entry is valid from then on */
+	_Atomic uint32_t ready;
+	uint32_t reserved;
+	char name[SLASH_STATS_NAME_SIZE];
+	_Atomic uint64_t count;
+	_Atomic uint64_t total_ns;
+	_Atomic uint64_t max_ns;
+	_Atomic uint64_t buckets[SLASH_STATS_BUCKETS];
+};
+
+#define SLASH_STATS_SIZE(max_entries) \
+	(sizeof(struct slash_stats_header) + (max_entries) * sizeof(struct slash_stats_entry))
+
+static inline unsigned int slash_stats_bucket(uint64_t ns) {
+	if (ns < (1u << SLASH_STATS_SUB_BITS))
+		return ns;
+	unsigned int exp = 63 - __builtin_clzll(ns);
+	if (exp >= SLASH_STATS_MAX_EXP)
+		return SLASH_STATS_BUCKETS - 1;
+	unsigned int sub = (ns >> (exp - SLASH_STATS_SUB_BITS)) & ((1u << SLASH_STATS_SUB_BITS) - 1);
+	return ((exp - SLASH_STATS_SUB_BITS + 1) << SLASH_STATS_SUB_BITS) + sub;
+}
+
+/* Lowest duration recorded in a bucket */
+static inline uint64_t slash_stats_bucket_low(unsigned int bucket) {
+	if (bucket < (1u << SLASH_STATS_SUB_BITS))
+		return bucket;
+	unsigned int exp = (bucket >> SLASH_STATS_SUB_BITS) + SLASH_STATS_SUB_BITS - 1;
+	uint64_t sub = bucket & ((1u << SLASH_STATS_SUB_BITS) - 1);
+	return ((1ull << SLASH_STATS_SUB_BITS) + sub) << (exp - SLASH_STATS_SUB_BITS);
+}
+
+/**
+ * @brief Create the shared memory segment and start recording command latencies.
+ *
+ * @param name shm_open() name of the segment, e.g. "/slash-stats"
+ * @return 0 on success, -1 on failure
+ */
+int slash_stats_open(const char * name);
+
+/**
+ * @brief Stop recording and remove the shared memory segment.
+ *
+ * Waits for the commands being recorded with slash_list_synchronize(), so it is called
+ * outside of a command, or the segment stays mapped until the process exits.
+ */
+void slash_stats_close(void);
+
+/**
+ * @brief Record the duration of a command, called by slash_execute().
+ */
+void slash_stats_record(const struct slash_command * command, uint64_t ns);
+
+#endif // SLASH_STATS_H
@@ -0,0 +1,31 @@
+#ifndef SLASH_TABLE_H
+#define SLASH_TABLE_H
+
+#include <stdint.h>
+#include <slash/slash.h>
+
+/**
+ * Const command table for static builds, generated after a first link by tools/slash_table_gen.py.
+ *
+ * When an application defines slash_static_table, slash_list_init() uses it as the command list
+ * directly: nothing is registered at boot, and commands are found with a perfect hash.
+ */
+struct slash_table {
+	unsigned int count;
+	unsigned int bucket_count;
+	/* All commands, sorted by name */
+	struct slash_command * const * commands;
+	/* Hash seed of each bucket */
+	const uint32_t * seeds;
+	/* Index into commands of each hash slot */
+	const uint16_t * slots;
+};
+
+extern const struct slash_table slash_static_table __attribute__((weak));
+
+/**
+ * @brief Hash function of the table, must match the one in tools/slash_table_gen.py
+ */
+uint32_t slash_table_hash(const char * name, size_t len, uint32_t seed);
+
+#endif // SLASH_TABLE_H
@@ -0,0 +1,92 @@
+#ifndef SLASH_TRACE_H
+#define SLASH_TRACE_H
+
+#include <stdint.h>
+#include <slash/slash.h>
+
+/**
+ * Binary execution trace.
+ *
+ * slash_execute() writes a fixed size record of every command into a ring, lock-free, before the
+ * command runs, and completes it with the duration and return value afterwards. The ring
+ * is written to a compact file on demand (slash_trace_dump(), "trace dump <file>") or when the
+ * application crashes, and tools/slash_trace_decode.py prints the file.
+ *
+ * File layout: a struct slash_trace_file_header, name_count command names of name_size bytes
+ * (indexed by the command field of the records), then the records, oldest first, until the end.
+ */
+
+#define SLASH_TRACE_MAGIC 0x52544c53 /* "SLTR" in little endian */
+#define SLASH_TRACE_VERSION 2
+
+/* Record flags: the command had not returned yet when the trace was written, a crash for example */
+#define SLASH_TRACE_RUNNING 0x1
+
+struct slash_trace_record {
+	/* CLOCK_MONOTONIC at the start of the command */
+	uint64_t timestamp_ns;
+	uint64_t duration_ns;
+	int32_t ret;
+	/* Index of the command name in the file, UINT16_MAX when all command ids were in use */
+	uint16_t command;
+	uint16_t flags;
+	/* Hash of the argument string */
+	uint32_t args_digest;
+	uint32_t reserved2;
+};
+
+struct slash_trace_file_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t record_size;
+	uint32_t name_size;
+	uint32_t name_count;
+	/* Add to a timestamp to get the CLOCK_REALTIME time of the record */
+	int64_t realtime_offset_ns;
+	/* Number of commands traced, including the ones no longer in the ring */
+	uint64_t total;
+};
+
+/**
+ * @brief Allocate the trace ring and start tracing.
+ * @param records number of records kept, rounded up to a power of two
+ * @return 0 on success, -1 on failure
+ */
+int slash_trace_start(size_t records);
+
+/**
+ * @brief Stop tracing and free the ring, no command may be executing.
+ */
+void slash_trace_stop(void);
+
+/**
+ * @brief Write the trace to a file.
+ * @return number of records written, -1 on failure
+ */
+int slash_trace_dump(const char * path);
+
+/**
+ * @brief Write the trace to a file descriptor, async-signal-safe.
+ * @return number of records written, -1 on failure
+ */
+int slash_trace_dump_fd(int fd);
+
+/**
+ * @brief Dump the trace to a file when the application crashes (SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT).
+ * @return 0 on success, -1 on failure
+ */
+int slash_trace_dump_on_crash(const char * path);
+
+/**
+ * @brief Record a command about to run, called by slash_execute().
+ * @return handle for slash_trace_end(), 0 when not tracing
+ */
+uint64_t slash_trace_begin(const struct slash_command * command, uint64_t timestamp_ns, uint32_t args_digest);
+
+/**
+ * @brief Complete the record of a command which returned, unless the ring has overwritten it meanwhile.
+ */
+void slash_trace_end(uint64_t handle, uint64_t duration_ns, int ret);
+
+#endif // SLASH_TRACE_H
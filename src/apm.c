@@ -0,0 +1,309 @@
+#define _GNU_SOURCE
+#include <slash/slash.h>
+
+#include <dlfcn.h>
+#include <link.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#include "builtins.h"
+
+#ifdef SLASH_HAVE_SCHED_YIELD
+#include <sched.h>
+#endif
+
+#define SLASH_APM_CACHE_MAGIC "slash-apm-cache 1"
+
+enum slash_apm_state {
+	SLASH_APM_UNLOADED,
+	SLASH_APM_LOADING,
+	SLASH_APM_LOADED,
+	SLASH_APM_FAILED,
+};
+
+struct slash_apm_lazy;
+
+/* A name stub standing in for a command of an APM which has not been loaded yet */
+struct slash_apm_stub {
+	struct slash_command cmd;
+	struct slash_apm_lazy * apm;
+};
+
+struct slash_apm_lazy {
+	char * path;
+	char * cache_path;
+	char * help;
+	_Atomic int state;
+	void * handle;
+	size_t count;
+	struct slash_apm_stub * stubs;
+	char * names;
+};
+
+/* Implement this function to initialize an APM when it is loaded by slash_init_apm_lazy() */
+__attribute__((weak)) void slash_on_apm_load_hook(const char * path, void * handle) {
+	(void)path;
+	(void)handle;
+}
+
+static int slash_apm_section(void * handle, struct slash_command ** start, struct slash_command ** stop) {
+
+	*start = dlsym(handle, "__start_slash");
+	*stop = dlsym(handle, "__stop_slash");
+	if (*start == NULL || *stop == NULL)
+		return -1;
+
+	/* dlsym() also searches the dependencies of the APM (slash itself for example),
+		so make sure the section belongs to the APM */
+	struct link_map * map;
+	Dl_info info;
+	if (dlinfo(handle, RTLD_DI_LINKMAP, &map) == 0 && dladdr(*start, &info) != 0) {
+		if (info.dli_fname && map->l_name && strcmp(info.dli_fname, map->l_name) != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+int slash_init_apm(void * handle) {
+
+	struct slash_command * start, * stop;
+	if (slash_apm_section(handle, &start, &stop) < 0)
+		return -1;
+
+	return slash_list_add_section(start, stop);
+}
+
+void * slash_apm_pin(const void * addr) {
+
+	/* A reference of our own on the shared object holding addr: a dlclose() of the APM
+		meanwhile only releases it once the reference is dropped */
+	Dl_info info;
+	if (dladdr(addr, &info) == 0 || info.dli_fname == NULL)
+		return NULL;
+
+	return dlopen(info.dli_fname, RTLD_LAZY | RTLD_NOLOAD);
+}
+
+void slash_apm_unpin(void * pin) {
+
+	if (pin)
+		dlclose(pin);
+}
+
+static int slash_apm_cache_stat(const char * path, long long * size, long long * mtime) {
+
+	struct stat st;
+	if (stat(path, &st) < 0)
+		return -1;
+
+	*size = st.st_size;
+	*mtime = st.st_mtime;
+	return 0;
+}
+
+static void slash_apm_cache_write(const char * path, const char * cache_path, void * handle) {
+
+	long long size, mtime;
+	struct slash_command * start, * stop;
+	if (slash_apm_cache_stat(path, &size, &mtime) < 0 || slash_apm_section(handle, &start, &stop) < 0)
+		return;
+
+	FILE * fp = fopen(cache_path, "w");
+	if (fp == NULL)
+		return;
+
+	fprintf(fp, "%s %lld %lld\n", SLASH_APM_CACHE_MAGIC, size, mtime);
+	for (struct slash_command * cmd = start; cmd < stop; cmd = slash_list_section_next(cmd))
+		fprintf(fp, "%s\n", cmd->name);
+
+	fclose(fp);
+}
+
+/* Read the command names of an up to date cache into a buffer of zero terminated strings */
+static char * slash_apm_cache_read(const char * path, const char * cache_path, size_t * count) {
+
+	long long size, mtime, cached_size, cached_mtime;
+	if (slash_apm_cache_stat(path, &size, &mtime) < 0)
+		return NULL;
+
+	FILE * fp = fopen(cache_path, "r");
+	if (fp == NULL)
+		return NULL;
+
+	if (fscanf(fp, SLASH_APM_CACHE_MAGIC " %lld %lld\n", &cached_size, &cached_mtime) != 2 ||
+		cached_size != size || cached_mtime != mtime) {
+		fclose(fp);
+		return NULL;
+	}
+
+	long start = ftell(fp);
+	fseek(fp, 0, SEEK_END);
+	long end = ftell(fp);
+	fseek(fp, start, SEEK_SET);
+	if (start < 0 || end <= start) {
+		fclose(fp);
+		return NULL;
+	}
+
+	char * names = malloc(end - start + 1);
+	if (names == NULL) {
+		fclose(fp);
+		return NULL;
+	}
+
+	size_t len = fread(names, 1, end - start, fp);
+	fclose(fp);
+	names[len] = '\0';
+
+	*count = 0;
+	for (size_t i = 0; i < len; i++) {
+		if (names[i] == '\n') {
+			names[i] = '\0';
+			(*count)++;
+		}
+	}
+
+	return names;
+}
+
+static int slash_apm_load(struct slash * slash, struct slash_apm_lazy * apm) {
+
+	int expected = SLASH_APM_UNLOADED;
+	if (!atomic_compare_exchange_strong(&apm->state, &expected, SLASH_APM_LOADING)) {
+		/* Another thread is loading the APM, which may take a while (dlopen() and the load hook) */
+		while (atomic_load(&apm->state) == SLASH_APM_LOADING) {
+#ifdef SLASH_HAVE_SCHED_YIELD
+			sched_yield();
+#endif
+		}
+		return atomic_load(&apm->state) == SLASH_APM_LOADED ? 0 : -1;
+	}
+
+	apm->handle = dlopen(apm->path, RTLD_NOW);
+	if (apm->handle == NULL) {
+		slash_printf(slash, "Failed to load %s: %s\n", apm->path, dlerror());
+		atomic_store(&apm->state, SLASH_APM_FAILED);
+		return -1;
+	}
+
+	slash_on_apm_load_hook(apm->path, apm->handle);
+
+	/* Replaces the stubs with the real commands in one batch */
+	if (slash_init_apm(apm->handle) < 0) {
+		slash_printf(slash, "No slash section in %s\n", apm->path);
+		atomic_store(&apm->state, SLASH_APM_FAILED);
+		return -1;
+	}
+
+	/* Drop stubs of commands which are no longer provided by the APM */
+	for (size_t i = 0; i < apm->count; i++) {
+		slash_list_read_lock();
+		struct slash_command * cmd = slash_list_find_name(apm->stubs[i].cmd.name);
+		slash_list_read_unlock();
+		if (cmd == &apm->stubs[i].cmd)
+			slash_list_remove(cmd);
+	}
+
+	slash_apm_cache_write(apm->path, apm->cache_path, apm->handle);
+
+	atomic_store(&apm->state, SLASH_APM_LOADED);
+	return 0;
+}
+
+static int slash_apm_stub_exec(struct slash * slash, void * context) {
+
+	struct slash_apm_stub * stub = context;
+	if (slash_apm_load(slash, stub->apm) < 0)
+		return SLASH_EIO;
+
+	slash_list_read_lock();
+	struct slash_command * command = slash_list_find_name(stub->cmd.name);
+	slash_list_read_unlock();
+	if (command == NULL || command == &stub->cmd || !command->func) {
+		slash_printf(slash, "No such command: %s\n", stub->cmd.name);
+		return SLASH_ENOENT;
+	}
+
+	if (command->context)
+		return command->func_ctx(slash, command->context);
+
+	return command->func(slash);
+}
+
+int slash_init_apm_lazy(const char * path, const char * cache_path) {
+
+	size_t count = 0;
+	char * names = slash_apm_cache_read(path, cache_path, &count);
+
+	if (names == NULL) {
+		/* No usable cache, load the APM now and create the cache for the next time */
+		void * handle = dlopen(path, RTLD_NOW);
+		if (handle == NULL) {
+			fprintf(stderr, "Failed to load %s: %s\n", path, dlerror());
+			return -1;
+		}
+
+		slash_on_apm_load_hook(path, handle);
+		int res = slash_init_apm(handle);
+		slash_apm_cache_write(path, cache_path, handle);
+		return res;
+	}
+
+	struct slash_apm_lazy * apm = calloc(1, sizeof(*apm));
+	struct slash_command ** items = calloc(count ? count : 1, sizeof(*items));
+	if (apm == NULL || items == NULL)
+		goto err;
+
+	apm->path = strdup(path);
+	apm->cache_path = strdup(cache_path);
+	apm->stubs = calloc(count ? count : 1, sizeof(*apm->stubs));
+	if (apm->path == NULL || apm->cache_path == NULL || apm->stubs == NULL)
+		goto err;
+
+	size_t help_len = strlen(path) + 64;
+	apm->help = malloc(help_len);
+	if (apm->help == NULL)
+		goto err;
+	snprintf(apm->help, help_len, "Provided by %s, which is loaded on first use", path);
+
+	apm->names = names;
+	apm->count = count;
+	atomic_init(&apm->state, SLASH_APM_UNLOADED);
+
+	char * name = names;
+	for (size_t i = 0; i < count; i++) {
+		struct slash_command stub = {
+			.name = name,
+			.func_ctx = slash_apm_stub_exec,
+			.help = apm->help,
+			.context = &apm->stubs[i],
+		};
+		memcpy(&apm->stubs[i].cmd, &stub, sizeof(stub));
+		apm->stubs[i].apm = apm;
+		items[i] = &apm->stubs[i].cmd;
+		name += strlen(name) + 1;
+	}
+
+	/* The stubs are registered as one batch, just like a loaded section */
+	if (slash_list_add_batch(items, count) < 0)
+		goto err;
+	free(items);
+
+	return count;
+
+err:
+	if (apm) {
+		free(apm->path);
+		free(apm->cache_path);
+		free(apm->stubs);
+		free(apm->help);
+	}
+	free(apm);
+	free(items);
+	free(names);
+	return -1;
+}
@@ -0,0 +1,454 @@
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <slash/slash.h>
+#include <slash/table.h>
+
+#include "builtins.h"
+
+#define SLASH_APROPOS_TERM_MAX	32	/* Longer words are indexed by their start */
+
+/**
+ * Inverted index of the words in the name, arguments and help of the commands.
+ *
+ * Every command indexed is a document, numbered in the order it was added, and every word
+ * has the ascending list of the documents containing it. The index follows the command list
+ * from one generation to the next: added commands are indexed, removed ones are only marked
+ * dead, since their strings may be gone with their APM. It is built again from scratch when
+ * half of the documents are dead.
+ */
+struct slash_apropos_term {
+	uint32_t hash;
+	char *word;
+	uint32_t *docs;
+	unsigned int count;
+	unsigned int size;
+};
+
+struct slash_apropos_doc {
+	struct slash_command *cmd;
+	/* The strings indexed, to tell a command added at the address of a removed one */
+	const char *name;
+	const char *args;
+	const char *help;
+	bool alive;
+	unsigned int seen;
+};
+
+struct slash_apropos {
+	bool valid;
+	unsigned int generation;
+	unsigned int epoch;
+
+	/* Words, open addressing with linear probing */
+	struct slash_apropos_term *terms;
+	unsigned int term_count;
+	unsigned int term_size;
+
+	struct slash_apropos_doc *docs;
+	unsigned int doc_count;
+	unsigned int doc_size;
+	unsigned int dead;
+
+	/* Document of each command, by address */
+	uint32_t *slots;
+	unsigned int slot_size;
+};
+
+#define SLASH_APROPOS_EMPTY	UINT32_MAX
+
+static uint32_t slash_apropos_ptr_hash(const void *ptr)
+{
+	uint64_t x = (uintptr_t) ptr;
+	return (uint32_t) ((x >> 4) * 0x9e3779b97f4a7c15ull >> 32);
+}
+
+static void slash_apropos_clear(struct slash_apropos *index)
+{
+	for (unsigned int i = 0; i < index->term_size; i++) {
+		free(index->terms[i].word);
+		free(index->terms[i].docs);
+	}
+	free(index->terms);
+	free(index->docs);
+	free(index->slots);
+	memset(index, 0, sizeof(*index));
+}
+
+static struct slash_apropos_term *slash_apropos_term(struct slash_apropos *index, const char *word, size_t len)
+{
+	if (index->term_size == 0)
+		return NULL;
+
+	uint32_t hash = slash_table_hash(word, len, 0);
+	unsigned int mask = index->term_size - 1;
+	for (unsigned int i = hash & mask; index->terms[i].word; i = (i + 1) & mask) {
+		struct slash_apropos_term *term = &index->terms[i];
+		if (term->hash == hash && strncmp(term->word, word, len) == 0 && term->word[len] == '\0')
+			return term;
+	}
+
+	return NULL;
+}
+
+static int slash_apropos_terms_grow(struct slash_apropos *index)
+{
+	/* Keep the load factor below 3/4 */
+	if (index->terms && (index->term_count + 1) * 4 < index->term_size * 3)
+		return 0;
+
+	unsigned int size = index->term_size ? index->term_size * 2 : 1024;
+	struct slash_apropos_term *terms = calloc(size, sizeof(*terms));
+	if (!terms)
+		return -1;
+
+	for (unsigned int i = 0; i < index->term_size; i++) {
+		if (!index->terms[i].word)
+			continue;
+		unsigned int j = index->terms[i].hash & (size - 1);
+		while (terms[j].word)
+			j = (j + 1) & (size - 1);
+		terms[j] = index->terms[i];
+	}
+
+	free(index->terms);
+	index->terms = terms;
+	index->term_size = size;
+
+	return 0;
+}
+
+/* Add doc to the documents of the word, documents are added in ascending order */
+static int slash_apropos_add_word(struct slash_apropos *index, const char *word, size_t len, uint32_t doc)
+{
+	struct slash_apropos_term *term = slash_apropos_term(index, word, len);
+	if (!term) {
+		if (slash_apropos_terms_grow(index) < 0)
+			return -1;
+		uint32_t hash = slash_table_hash(word, len, 0);
+		unsigned int mask = index->term_size - 1;
+		unsigned int i = hash & mask;
+		while (index->terms[i].word)
+			i = (i + 1) & mask;
+		term = &index->terms[i];
+		term->word = strndup(word, len);
+		if (!term->word)
+			return -1;
+		term->hash = hash;
+		index->term_count++;
+	}
+
+	/* Once per document */
+	if (term->count > 0 && term->docs[term->count - 1] == doc)
+		return 0;
+
+	if (term->count == term->size) {
+		unsigned int size = term->size ? term->size * 2 : 4;
+		uint32_t *docs = realloc(term->docs, size * sizeof(*docs));
+		if (!docs)
+			return -1;
+		term->docs = docs;
+		term->size = size;
+	}
+	term->docs[term->count++] = doc;
+
+	return 0;
+}
+
+/* Lower case words of letters and digits, calls func for each, stops at the first error */
+static int slash_apropos_words(const char *text, int (*func)(void *ctx, const char *word, size_t len), void *ctx)
+{
+	char word[SLASH_APROPOS_TERM_MAX];
+
+	while (text && *text) {
+		while (*text && !isalnum((unsigned char) *text))
+			text++;
+		size_t len = 0;
+		while (isalnum((unsigned char) *text)) {
+			if (len < sizeof(word))
+				word[len++] = tolower((unsigned char) *text);
+			text++;
+		}
+		if (len > 0 && func(ctx, word, len) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+struct slash_apropos_add_ctx {
+	struct slash_apropos *index;
+	uint32_t doc;
+};
+
+static int slash_apropos_add_func(void *ctx, const char *word, size_t len)
+{
+	struct slash_apropos_add_ctx *add = ctx;
+	return slash_apropos_add_word(add->index, word, len, add->doc);
+}
+
+static int slash_apropos_slots_grow(struct slash_apropos *index)
+{
+	if (index->slots && (index->doc_count + 1) * 2 < index->slot_size)
+		return 0;
+
+	unsigned int size = index->slot_size ? index->slot_size * 2 : 1024;
+	uint32_t *slots = malloc(size * sizeof(*slots));
+	if (!slots)
+		return -1;
+	memset(slots, 0xff, size * sizeof(*slots));
+
+	/* Only the documents alive are reached through their address */
+	for (uint32_t doc = 0; doc < index->doc_count; doc++) {
+		if (!index->docs[doc].alive)
+			continue;
+		unsigned int i = slash_apropos_ptr_hash(index->docs[doc].cmd) & (size - 1);
+		while (slots[i] != SLASH_APROPOS_EMPTY)
+			i = (i + 1) & (size - 1);
+		slots[i] = doc;
+	}
+
+	free(index->slots);
+	index->slots = slots;
+	index->slot_size = size;
+
+	return 0;
+}
+
+static uint32_t *slash_apropos_slot(struct slash_apropos *index, const struct slash_command *cmd)
+{
+	unsigned int mask = index->slot_size - 1;
+	unsigned int i = slash_apropos_ptr_hash(cmd) & mask;
+
+	while (index->slots[i] != SLASH_APROPOS_EMPTY) {
+		if (index->docs[index->slots[i]].cmd == cmd)
+			return &index->slots[i];
+		i = (i + 1) & mask;
+	}
+
+	return &index->slots[i];
+}
+
+static int slash_apropos_add_doc(struct slash_apropos *index, struct slash_command *cmd)
+{
+	if (slash_apropos_slots_grow(index) < 0)
+		return -1;
+
+	if (index->doc_count == index->doc_size) {
+		unsigned int size = index->doc_size ? index->doc_size * 2 : 256;
+		struct slash_apropos_doc *docs = realloc(index->docs, size * sizeof(*docs));
+		if (!docs)
+			return -1;
+		index->docs = docs;
+		index->doc_size = size;
+	}
+
+	uint32_t doc = index->doc_count++;
+	index->docs[doc].cmd = cmd;
+	index->docs[doc].name = cmd->name;
+	index->docs[doc].args = cmd->args;
+	index->docs[doc].help = cmd->help;
+	index->docs[doc].alive = true;
+	index->docs[doc].seen = index->epoch;
+	*slash_apropos_slot(index, cmd) = doc;
+
+	struct slash_apropos_add_ctx add = {index, doc};
+	if (slash_apropos_words(cmd->name, slash_apropos_add_func, &add) < 0 ||
+		slash_apropos_words(cmd->args, slash_apropos_add_func, &add) < 0 ||
+		slash_apropos_words(cmd->help, slash_apropos_add_func, &add) < 0)
+		return -1;
+
+	return 0;
+}
+
+/* Mark a document dead, and take it out of the address table moving back the entries after it */
+static void slash_apropos_forget(struct slash_apropos *index, uint32_t doc)
+{
+	struct slash_apropos_doc *d = &index->docs[doc];
+	d->alive = false;
+	index->dead++;
+
+	unsigned int mask = index->slot_size - 1;
+	unsigned int hole = slash_apropos_slot(index, d->cmd) - index->slots;
+	for (unsigned int j = (hole + 1) & mask; index->slots[j] != SLASH_APROPOS_EMPTY; j = (j + 1) & mask) {
+		unsigned int home = slash_apropos_ptr_hash(index->docs[index->slots[j]].cmd) & mask;
+		if (((j - home) & mask) >= ((j - hole) & mask)) {
+			index->slots[hole] = index->slots[j];
+			hole = j;
+		}
+	}
+	index->slots[hole] = SLASH_APROPOS_EMPTY;
+}
+
+/* Bring the index up to the current command list, called with it read locked */
+static int slash_apropos_update(struct slash_apropos *index)
+{
+	unsigned int generation = slash_list_generation();
+	if (index->valid && index->generation == generation)
+		return 0;
+
+	if (index->dead > index->doc_count / 2)
+		slash_apropos_clear(index);
+	index->valid = false;
+	index->epoch++;
+
+	/* Index the commands added since the last update */
+	struct slash_command *cmd;
+	slash_list_iterator i = {0};
+	while ((cmd = slash_list_iterate(&i)) != NULL) {
+		uint32_t *slot = index->slots ? slash_apropos_slot(index, cmd) : NULL;
+		if (slot && *slot != SLASH_APROPOS_EMPTY) {
+			struct slash_apropos_doc *d = &index->docs[*slot];
+			if (d->name == cmd->name && d->args == cmd->args && d->help == cmd->help) {
+				d->seen = index->epoch;
+				continue;
+			}
+			/* A new command at the address of a removed one, the strings are only compared */
+			slash_apropos_forget(index, *slot);
+		}
+		if (slash_apropos_add_doc(index, cmd) < 0) {
+			slash_apropos_clear(index);
+			return -1;
+		}
+	}
+
+	/* And forget the removed ones, without reading them */
+	for (uint32_t doc = 0; doc < index->doc_count; doc++) {
+		struct slash_apropos_doc *d = &index->docs[doc];
+		if (!d->alive || d->seen == index->epoch)
+			continue;
+		slash_apropos_forget(index, doc);
+	}
+
+	index->generation = generation;
+	index->valid = true;
+
+	return 0;
+}
+
+struct slash_apropos_query_ctx {
+	struct slash_apropos *index;
+	/* Number of the query words matched by each document so far */
+	uint16_t *matched;
+	uint16_t words;
+};
+
+static void slash_apropos_match_term(struct slash_apropos_query_ctx *query, const struct slash_apropos_term *term)
+{
+	for (unsigned int i = 0; i < term->count; i++) {
+		uint16_t *matched = &query->matched[term->docs[i]];
+		if (*matched == query->words)
+			(*matched)++;
+	}
+}
+
+static int slash_apropos_query_func(void *ctx, const char *word, size_t len)
+{
+	struct slash_apropos_query_ctx *query = ctx;
+	struct slash_apropos *index = query->index;
+
+	const struct slash_apropos_term *term = slash_apropos_term(index, word, len);
+	if (term)
+		slash_apropos_match_term(query, term);
+	query->words++;
+
+	return 0;
+}
+
+static void slash_apropos_prefix(struct slash_apropos_query_ctx *query, const char *prefix, size_t len)
+{
+	for (unsigned int i = 0; i < query->index->term_size; i++) {
+		const struct slash_apropos_term *term = &query->index->terms[i];
+		if (term->word && strncmp(term->word, prefix, len) == 0)
+			slash_apropos_match_term(query, term);
+	}
+	query->words++;
+}
+
+static int slash_apropos_compare(const void *a, const void *b)
+{
+	const struct slash_command *ca = *(struct slash_command * const *) a;
+	const struct slash_command *cb = *(struct slash_command * const *) b;
+	return strcmp(ca->name, cb->name);
+}
+
+int slash_apropos(struct slash *slash, char **words, int count)
+{
+	struct slash_apropos *index = slash->apropos;
+	if (!index) {
+		index = calloc(1, sizeof(*index));
+		if (!index)
+			return SLASH_ENOMEM;
+		slash->apropos = index;
+	}
+
+	slash_list_read_lock();
+	if (slash_apropos_update(index) < 0) {
+		slash_list_read_unlock();
+		return SLASH_ENOMEM;
+	}
+
+	struct slash_apropos_query_ctx query = {
+		.index = index,
+		.matched = slash_alloc(slash, slash_max(index->doc_count, 1u) * sizeof(uint16_t)),
+		.words = 0,
+	};
+	struct slash_command **found = slash_alloc(slash, slash_max(index->doc_count, 1u) * sizeof(*found));
+	if (!query.matched || !found) {
+		slash_list_read_unlock();
+		return SLASH_ENOMEM;
+	}
+	memset(query.matched, 0, index->doc_count * sizeof(uint16_t));
+
+	/* Every word of the query must be found, split like the indexed text.
+	 * A word ending with '*' matches all words starting with it. */
+	for (int i = 0; i < count; i++) {
+		size_t len = strlen(words[i]);
+		if (len > 1 && words[i][len - 1] == '*') {
+			char prefix[SLASH_APROPOS_TERM_MAX];
+			size_t n = 0;
+			for (size_t j = 0; j < len - 1 && n < sizeof(prefix); j++)
+				prefix[n++] = tolower((unsigned char) words[i][j]);
+			slash_apropos_prefix(&query, prefix, n);
+		} else {
+			slash_apropos_words(words[i], slash_apropos_query_func, &query);
+		}
+	}
+
+	unsigned int found_count = 0;
+	int width = 0;
+	for (uint32_t doc = 0; doc < index->doc_count && query.words > 0; doc++) {
+		if (index->docs[doc].alive && query.matched[doc] == query.words) {
+			found[found_count++] = index->docs[doc].cmd;
+			width = slash_max(width, (int) strlen(index->docs[doc].cmd->name));
+		}
+	}
+	qsort(found, found_count, sizeof(*found), slash_apropos_compare);
+
+	/* The name and the first line of the help */
+	for (unsigned int i = 0; i < found_count; i++) {
+		const char *help = found[i]->help ? found[i]->help : "";
+		int help_len = strcspn(help, "\n");
+		slash_printf(slash, "%-*s  %.*s\n", width, found[i]->name, help_len, help);
+	}
+	slash_list_read_unlock();
+
+	if (found_count == 0) {
+		slash_printf(slash, "Nothing appropriate\n");
+		return SLASH_ENOENT;
+	}
+
+	return SLASH_SUCCESS;
+}
+
+void slash_apropos_free(struct slash *slash)
+{
+	if (!slash->apropos)
+		return;
+
+	slash_apropos_clear(slash->apropos);
+	free(slash->apropos);
+	slash->apropos = NULL;
+}
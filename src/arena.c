@@ -0,0 +1,80 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <slash/slash.h>
+
+#include "builtins.h"
+
+#define SLASH_ARENA_ALIGN(size) (((size) + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1))
+
+/* Allocations which do not fit in the arena buffer */
+struct slash_arena_chunk {
+	struct slash_arena_chunk *next;
+	max_align_t data[];
+};
+
+void slash_set_arena(struct slash *slash, void *buf, size_t size)
+{
+	/* Align the start of the storage */
+	uintptr_t start = SLASH_ARENA_ALIGN((uintptr_t) buf);
+	if (buf == NULL || start - (uintptr_t) buf >= size) {
+		slash->arena = NULL;
+		slash->arena_size = 0;
+	} else {
+		slash->arena = (char *) start;
+		slash->arena_size = size - (start - (uintptr_t) buf);
+	}
+	slash->arena_used = 0;
+}
+
+void *slash_alloc(struct slash *slash, size_t size)
+{
+	size = SLASH_ARENA_ALIGN(size);
+	if (size <= slash->arena_size - slash->arena_used) {
+		void *ptr = slash->arena + slash->arena_used;
+		slash->arena_used += size;
+		return ptr;
+	}
+
+	struct slash_arena_chunk *chunk = malloc(sizeof(*chunk) + size);
+	if (!chunk)
+		return NULL;
+	chunk->next = slash->arena_chunks;
+	slash->arena_chunks = chunk;
+
+	return chunk->data;
+}
+
+void slash_arena_save(struct slash *slash, struct slash_arena_mark *mark)
+{
+	mark->used = slash->arena_used;
+	mark->chunks = slash->arena_chunks;
+	slash->arena_depth++;
+}
+
+static void slash_arena_free_chunks(struct slash *slash, struct slash_arena_chunk *keep)
+{
+	while (slash->arena_chunks != keep) {
+		struct slash_arena_chunk *chunk = slash->arena_chunks;
+		slash->arena_chunks = chunk->next;
+		free(chunk);
+	}
+}
+
+void slash_arena_restore(struct slash *slash, const struct slash_arena_mark *mark)
+{
+	/* The outermost command also releases what was allocated outside of commands */
+	if (--slash->arena_depth > 0) {
+		slash->arena_used = mark->used;
+		slash_arena_free_chunks(slash, mark->chunks);
+	} else {
+		slash_arena_reset(slash);
+	}
+}
+
+void slash_arena_reset(struct slash *slash)
+{
+	slash->arena_used = 0;
+	slash_arena_free_chunks(slash, NULL);
+}
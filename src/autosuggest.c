@@ -0,0 +1,246 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <slash/slash.h>
+
+#include "builtins.h"
+
+/* An entry of the history, where it starts in the ring and when it was added */
+struct slash_autosuggest_entry {
+	char *entry;
+	uint32_t seq;
+};
+
+/**
+ * The history entries sorted by text and then by age, so the entries starting with a prefix
+ * are next to each other and found by binary search. The ring keeps the text, the index only
+ * points into it, and follows the entries added to and removed from the ring.
+ */
+struct slash_autosuggest {
+	struct slash_autosuggest_entry *entries;
+	unsigned int count;
+	unsigned int size;
+	uint32_t seq;
+	/* Bumped when the entries change, the hint may be gone or older than a new one */
+	unsigned int version;
+
+	/* Most recent entry starting with the prefix, NULL for none */
+	char *hint;
+	unsigned int hint_version;
+	char *prefix;
+	size_t prefix_length;
+
+	/* The rest of the hint after the line */
+	char *suffix;
+	/* Size of prefix and suffix, the line buffer may grow */
+	size_t line_size;
+};
+
+/* Compare the first n characters of an entry in the ring with s, like strncmp() */
+static int slash_autosuggest_cmp(struct slash *slash, char *entry, const char *s, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		unsigned char a = *entry, b = s[i];
+		if (a != b)
+			return a - b;
+		if (a == '\0')
+			break;
+		entry = slash_history_increment(slash, entry);
+	}
+
+	return 0;
+}
+
+/* Compare two entries in the ring, like strcmp() */
+static int slash_autosuggest_cmp_entries(struct slash *slash, char *a, char *b)
+{
+	while (*a == *b && *a != '\0') {
+		a = slash_history_increment(slash, a);
+		b = slash_history_increment(slash, b);
+	}
+
+	return (unsigned char) *a - (unsigned char) *b;
+}
+
+/* First entry comparing above the first n characters of s, or at or above it when equal is false */
+static unsigned int slash_autosuggest_bound(struct slash *slash, struct slash_autosuggest *index,
+											const char *s, size_t n, bool equal)
+{
+	unsigned int lo = 0, hi = index->count;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+		int cmp = slash_autosuggest_cmp(slash, index->entries[mid].entry, s, n);
+		if (cmp < 0 || (equal && cmp == 0))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static int slash_autosuggest_reserve(struct slash *slash, struct slash_autosuggest *index)
+{
+	if (index->line_size >= slash->line_size)
+		return 0;
+
+	char *prefix = realloc(index->prefix, slash->line_size);
+	if (!prefix)
+		return -1;
+	index->prefix = prefix;
+
+	char *suffix = realloc(index->suffix, slash->line_size);
+	if (!suffix)
+		return -1;
+	index->suffix = suffix;
+	index->line_size = slash->line_size;
+
+	return 0;
+}
+
+void slash_autosuggest_add(struct slash *slash, char *entry)
+{
+	struct slash_autosuggest *index = slash->autosuggest;
+	if (!index) {
+		index = calloc(1, sizeof(*index));
+		if (!index)
+			return;
+		slash->autosuggest = index;
+	}
+
+	if (index->count == index->size) {
+		unsigned int size = index->size ? index->size * 2 : 64;
+		struct slash_autosuggest_entry *entries = realloc(index->entries, size * sizeof(*entries));
+		if (!entries)
+			return;
+		index->entries = entries;
+		index->size = size;
+	}
+
+	/* After the older entries of the same text, the ring is searched with the copy in it */
+	unsigned int lo = 0, hi = index->count;
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+		if (slash_autosuggest_cmp_entries(slash, index->entries[mid].entry, entry) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	memmove(&index->entries[lo + 1], &index->entries[lo], (index->count - lo) * sizeof(*index->entries));
+	index->entries[lo].entry = entry;
+	index->entries[lo].seq = index->seq++;
+	index->count++;
+
+	/* The new entry may be more recent than the hint */
+	index->version++;
+}
+
+void slash_autosuggest_remove(struct slash *slash, char *entry)
+{
+	struct slash_autosuggest *index = slash->autosuggest;
+	if (!index || *entry == '\0')
+		return;
+
+	unsigned int lo = 0, hi = index->count;
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+		if (slash_autosuggest_cmp_entries(slash, index->entries[mid].entry, entry) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	/* Among the entries of the same text */
+	for (; lo < index->count; lo++) {
+		if (index->entries[lo].entry == entry)
+			break;
+		if (slash_autosuggest_cmp_entries(slash, index->entries[lo].entry, entry) != 0)
+			return;
+	}
+	if (lo == index->count)
+		return;
+
+	index->count--;
+	memmove(&index->entries[lo], &index->entries[lo + 1], (index->count - lo) * sizeof(*index->entries));
+	index->version++;
+}
+
+/* An entry was taken out of the middle of the ring, the order of the others is the same */
+void slash_autosuggest_moved(struct slash *slash, char *removed, size_t len)
+{
+	struct slash_autosuggest *index = slash->autosuggest;
+	if (!index)
+		return;
+
+	for (unsigned int i = 0; i < index->count; i++)
+		index->entries[i].entry = slash_history_moved(slash, index->entries[i].entry, removed, len);
+	index->version++;
+}
+
+/**
+ * The most recent entry starting with the line is searched again only when the line no longer
+ * extends the prefix of the last search, or the hint no longer starts with it: while typing, the
+ * hint of the shorter line is the most recent of the entries that still match.
+ */
+const char *slash_autosuggest(struct slash *slash, size_t *length)
+{
+	struct slash_autosuggest *index = slash->autosuggest;
+	const char *line = slash->buffer;
+	size_t len = slash->length;
+
+	*length = 0;
+	if (!index || index->count == 0 || len == 0 || slash_autosuggest_reserve(slash, index) < 0)
+		return NULL;
+
+	bool valid = index->hint_version == index->version && len >= index->prefix_length &&
+		memcmp(index->prefix, line, index->prefix_length) == 0;
+	if (valid && index->hint && slash_autosuggest_cmp(slash, index->hint, line, len) != 0)
+		valid = false;
+
+	if (!valid) {
+		unsigned int lo = slash_autosuggest_bound(slash, index, line, len, false);
+		unsigned int hi = slash_autosuggest_bound(slash, index, line, len, true);
+
+		index->hint = NULL;
+		uint32_t seq = 0;
+		for (unsigned int i = lo; i < hi; i++) {
+			if (!index->hint || index->entries[i].seq > seq) {
+				index->hint = index->entries[i].entry;
+				seq = index->entries[i].seq;
+			}
+		}
+
+		memcpy(index->prefix, line, len);
+		index->prefix_length = len;
+		index->hint_version = index->version;
+	}
+
+	if (!index->hint)
+		return NULL;
+
+	/* Skip the line, the rest is copied out of the ring */
+	char *c = index->hint;
+	for (size_t i = 0; i < len; i++)
+		c = slash_history_increment(slash, c);
+	while (*c != '\0' && len + *length + 1 < slash->line_size) {
+		index->suffix[(*length)++] = *c;
+		c = slash_history_increment(slash, c);
+	}
+
+	return *length > 0 ? index->suffix : NULL;
+}
+
+void slash_autosuggest_free(struct slash *slash)
+{
+	if (!slash->autosuggest)
+		return;
+
+	free(slash->autosuggest->entries);
+	free(slash->autosuggest->prefix);
+	free(slash->autosuggest->suffix);
+	free(slash->autosuggest);
+	slash->autosuggest = NULL;
+}
@@ -3,11 +3,19 @@
 #include <string.h>
 #include <stdbool.h>
 #include <time.h>
+#include <limits.h>
 
 #include <slash/slash.h>
 #include <slash/optparse.h>
 #include <slash/completer.h>
 
+#ifdef SLASH_TRACE
+#include <slash/trace.h>
+#endif
+#ifdef SLASH_RECORD
+#include <slash/record.h>
+#endif
+
 #include "builtins.h"
 
 
@@ -15,21 +23,19 @@
 static int slash_builtin_help(struct slash *slash)
 {
 	char *args;
-	char find[slash->line_size];
+	char *find;
 	int i;
-	size_t available = sizeof(find);
+	size_t available = slash->line_size;
 	struct slash_command *command;
 
 	/* If no arguments given, just list all top-level commands */
 	if (slash->argc < 2) {
-		struct slash_command * cmd;
-		slash_list_iterator iter = {0};
-		while ((cmd = slash_list_iterate(&iter)) != NULL) {
-			slash_command_description(slash, cmd);
-		}
-		return SLASH_SUCCESS;
+		return slash_help_list(slash);
 	}
 
+	find = slash_alloc(slash, slash->line_size);
+	if (!find)
+		return SLASH_ENOMEM;
 	find[0] = '\0';
 
 	for (i = 1; i < slash->argc; i++) {
@@ -38,18 +44,33 @@ static int slash_builtin_help(struct slash *slash)
 		strcat(find, slash->argv[i]);
 		strcat(find, " ");
 	}
+	slash_list_read_lock();
 	command = slash_command_find(slash, find, strlen(find), &args);
 	if (!command) {
+		slash_list_read_unlock();
 		slash_printf(slash, "No such command: %s\n", find);
+		slash_suggest(slash, find);
 		return SLASH_EINVAL;
 	}
 
 	slash_command_usage(slash, command);
+	slash_list_read_unlock();
 
 	return SLASH_SUCCESS;
 }
 slash_command_completer(help, slash_builtin_help, slash_help_completer, "[command]", "Show available commands")
 
+static int slash_builtin_apropos(struct slash *slash)
+{
+	if (slash->argc < 2)
+		return SLASH_EUSAGE;
+
+	return slash_apropos(slash, &slash->argv[1], slash->argc - 1);
+}
+slash_command(apropos, slash_builtin_apropos, "<words...>",
+			  "Search the names, arguments and help of the commands for all\n"
+			  "the words, a word ending with * matches the words it starts")
+
 static int slash_builtin_history(struct slash *slash)
 {
 	char *p = slash->history_head;
@@ -76,6 +97,55 @@ static int slash_builtin_echo(struct slash *slash)
 }
 slash_command(echo, slash_builtin_echo, "[string]", "Display a line of text")
 
+static int slash_builtin_var_set(struct slash *slash)
+{
+	if (slash->argc < 2)
+		return SLASH_EUSAGE;
+
+	/* The value is the rest of the arguments */
+	char *value = slash_alloc(slash, slash->line_size);
+	if (!value)
+		return SLASH_ENOMEM;
+	value[0] = '\0';
+	for (int i = 2; i < slash->argc; i++) {
+		if (strlen(value) + strlen(slash->argv[i]) + 2 > slash->line_size)
+			return SLASH_ENOSPC;
+		if (i > 2)
+			strcat(value, " ");
+		strcat(value, slash->argv[i]);
+	}
+
+	int ret = slash_var_set(slash, slash->argv[1], value);
+	if (ret == SLASH_EINVAL)
+		slash_printf(slash, "Invalid variable name: %s\n", slash->argv[1]);
+	return ret;
+}
+slash_command_sub(var, set, slash_builtin_var_set, "<name> [value]", "Set a variable, expanded as $name or ${name}")
+
+static int slash_builtin_var_unset(struct slash *slash)
+{
+	if (slash->argc != 2)
+		return SLASH_EUSAGE;
+
+	int ret = slash_var_unset(slash, slash->argv[1]);
+	if (ret == SLASH_ENOENT)
+		slash_printf(slash, "No such variable: %s\n", slash->argv[1]);
+	return ret;
+}
+slash_command_sub(var, unset, slash_builtin_var_unset, "<name>", "Remove a variable")
+
+static void slash_builtin_var_print(struct slash *slash, const char *name, const char *value)
+{
+	slash_printf(slash, "%s=%s\n", name, value);
+}
+
+static int slash_builtin_var_list(struct slash *slash)
+{
+	slash_var_foreach(slash, slash_builtin_var_print);
+	return SLASH_SUCCESS;
+}
+slash_command_sub(var, list, slash_builtin_var_list, NULL, "List the variables")
+
 #ifndef SLASH_NO_EXIT
 static int slash_builtin_exit(struct slash *slash)
 {
@@ -85,49 +155,177 @@ static int slash_builtin_exit(struct slash *slash)
 slash_command(exit, slash_builtin_exit, NULL, "Exit application")
 #endif
 
+#ifdef SLASH_TRACE
+static int slash_builtin_trace_dump(struct slash *slash)
+{
+	if (slash->argc != 2)
+		return SLASH_EUSAGE;
+
+	int records = slash_trace_dump(slash->argv[1]);
+	if (records < 0) {
+		slash_printf(slash, "Failed to write trace to %s\n", slash->argv[1]);
+		return SLASH_EIO;
+	}
+
+	slash_printf(slash, "Wrote %d commands to %s\n", records, slash->argv[1]);
+	return SLASH_SUCCESS;
+}
+slash_command_sub(trace, dump, slash_builtin_trace_dump, "<file>", "Write the execution trace to a file")
+#endif
+
+#ifdef SLASH_RECORD
+static int slash_builtin_record_start(struct slash *slash)
+{
+	if (slash->argc != 2)
+		return SLASH_EUSAGE;
+
+	if (slash_record_start(slash, slash->argv[1]) < 0) {
+		slash_printf(slash, "Failed to start recording to %s\n", slash->argv[1]);
+		return SLASH_EIO;
+	}
+
+	return SLASH_SUCCESS;
+}
+slash_command_sub(record, start, slash_builtin_record_start, "<file>", "Record the keystrokes and commands of this session")
+
+static int slash_builtin_record_stop(struct slash *slash)
+{
+	slash_record_stop(slash);
+	return SLASH_SUCCESS;
+}
+slash_command_sub(record, stop, slash_builtin_record_stop, NULL, "Stop recording")
+
+struct slash_replay_opts {
+	unsigned int speed;
+};
+
+static const struct slash_opt slash_replay_opts[] = {
+	SLASH_OPT_UNSIGNED('s', "speed", "N", struct slash_replay_opts, speed, "replay N times faster, 0 for as fast as possible (default = 1)"),
+	SLASH_OPT_END,
+};
+
+static int slash_builtin_replay(struct slash *slash)
+{
+	struct slash_replay_opts opts = {
+		.speed = 1,
+	};
+
+	int argi = slash_opts_parse(slash, slash_replay_opts, &opts);
+	if (argi < 0 || argi + 1 != slash->argc)
+		return SLASH_EUSAGE;
+
+	if (slash_replay(slash, slash->argv[argi], opts.speed) < 0)
+		return SLASH_EIO;
+
+	return SLASH_SUCCESS;
+}
+slash_command_opts(replay, slash_builtin_replay, NULL, "<file>", "Replay a recorded session and measure the commands", slash_replay_opts)
+#endif
+
 void slash_require_activation(struct slash *slash, bool activate)
 {
 	slash->use_activate = activate;
 }
 
 static int slash_builtin_confirm(struct slash *slash) {
-	optparse_t * parser = optparse_new("confirm", "[]");
-	optparse_add_help(parser);
+	/* Set up once per thread, later invocations only clear the parsed state */
+	static _Thread_local char storage[OPTPARSE_ARENA_SIZE(1)];
+	static _Thread_local optparse_t * parser;
+	if (!parser) {
+		parser = optparse_new_arena(storage, sizeof(storage), "confirm", "[]", NULL);
+		if (!parser)
+			return SLASH_ENOMEM;
+		optparse_add_help(parser);
+	}
+	optparse_reset(parser);
+
+	if (optparse_parse(parser, slash->argc - 1, (const char **) slash->argv + 1) < 0)
+		return SLASH_EINVAL;
 
 	printf("Confirm: Type 'yes' or 'y' + enter to continue:\n");
 	char * c = slash_readline(slash);
 	if (strcasecmp(c, "yes") == 0 || strcasecmp(c, "y") == 0) {
-		optparse_del(parser);
 		return SLASH_SUCCESS;
 	} else {
-		optparse_del(parser);
 		return SLASH_EBREAK;
 	}
 }
 slash_command(confirm, slash_builtin_confirm, "", "Block until user confirmation")
 
+static int slash_builtin_timeout(struct slash *slash)
+{
+	if (slash->argc < 2)
+		return SLASH_EUSAGE;
+
+	char *end;
+	unsigned long ms = strtoul(slash->argv[1], &end, 0);
+	if (*end != '\0' || ms > UINT_MAX)
+		return SLASH_EUSAGE;
+
+	/* Without a command, set the default of the following commands */
+	if (slash->argc == 2) {
+		slash_set_timeout(slash, ms);
+		return SLASH_SUCCESS;
+	}
+
+	/* The command as typed after the deadline, with its quotes */
+	const char *rest = slash->args + strspn(slash->args, " ");
+	rest += strcspn(rest, " ");
+	rest += strspn(rest, " ");
+	char *line = slash_alloc(slash, strlen(rest) + 1);
+	if (!line)
+		return SLASH_ENOMEM;
+	strcpy(line, rest);
+
+	/* The command gets this deadline, still capped by the one of an outer command */
+	slash_timeout_nested(slash);
+	uint64_t deadline = slash_deadline_arm(slash, ms);
+	slash->deadline_explicit = true;
+	int ret = slash_execute(slash, line);
+	slash->deadline_explicit = false;
+	slash->deadline_ns = deadline;
+
+	return ret;
+}
+slash_command_completer(timeout, slash_builtin_timeout, slash_timeout_completer, "<ms> [command...]",
+						"Run a command with a deadline, or set the deadline of all commands (0 for none)")
+
+struct slash_watch_opts {
+	unsigned int interval;
+	unsigned int count;
+};
+
+static const struct slash_opt slash_watch_opts[] = {
+	SLASH_OPT_UNSIGNED('n', "interval", "NUM", struct slash_watch_opts, interval, "interval in milliseconds (default = 1000)"),
+	SLASH_OPT_UNSIGNED('c', "count", "NUM", struct slash_watch_opts, count, "number of times to repeat (default = infinite)"),
+	SLASH_OPT_END,
+};
+
 static int slash_builtin_watch(struct slash *slash)
 {
+	slash_timeout_nested(slash);
 
-	unsigned int interval = 1000;
-	unsigned int count = 0;
+	struct slash_watch_opts opts = {
+		.interval = 1000,
+		.count = 0,
+	};
 
-    optparse_t * parser = optparse_new("watch", "<command...>");
-    optparse_add_help(parser);
-	optparse_add_unsigned(parser, 'n', "interval", "NUM", 0, &interval, "interval in milliseconds (default = <env timeout>)");
-	optparse_add_unsigned(parser, 'c', "count", "NUM", 0, &count, "number of times to repeat (default = infinite)");
+	int argi = slash_opts_parse(slash, slash_watch_opts, &opts);
+	if (argi < 0) {
+		return SLASH_EUSAGE;
+	}
 
-    int argi = optparse_parse(parser, slash->argc - 1, (const char **) slash->argv + 1);
-    if (argi < 0) {
-        optparse_del(parser);
-	    return SLASH_EINVAL;
-    }
+	unsigned int interval = opts.interval;
+	unsigned int count = opts.count;
 
 	/* Build command string */
 
-	char line[slash->line_size];
+	char *line = slash_alloc(slash, slash->line_size);
+	char *cmd_exec = slash_alloc(slash, slash->line_size);
+	if (!line || !cmd_exec)
+		return SLASH_ENOMEM;
 	line[0] = '\0';
-	for (int arg = argi + 1; arg < slash->argc; arg++) {
+	for (int arg = argi; arg < slash->argc; arg++) {
 		strncat(line, slash->argv[arg], slash->line_size - strlen(line));
 		strncat(line, " ", slash->line_size - strlen(line));
 	}
@@ -137,7 +335,6 @@ static int slash_builtin_watch(struct slash *slash)
 	while(1) {
 
 		/* Make another copy, since slash_exec will modify this */
-		char cmd_exec[slash->line_size];
 		strncpy(cmd_exec, line, slash->line_size);
 
 		/* Read time it takes to execute command */
@@ -164,7 +361,6 @@ static int slash_builtin_watch(struct slash *slash)
 
 	}
 
-	optparse_del(parser);
 	return SLASH_SUCCESS;
 }
-slash_command_completer(watch, slash_builtin_watch, slash_watch_completer, "<command...>", "Repeat a command")
\ No newline at end of file
+slash_command_opts(watch, slash_builtin_watch, slash_watch_completer, "<command...>", "Repeat a command", slash_watch_opts)
\ No newline at end of file
@@ -4,16 +4,130 @@
 #include <sys/types.h>
 
 /* Configuration */
-#define SLASH_ARG_MAX		32	/* Maximum number of arguments */
-#define SLASH_SHOW_MAX		25	/* Maximum number of commands to list */
+#define SLASH_ARG_MAX		32	/* Number of arguments kept on the stack, more are allocated */
+#define SLASH_SHOW_MAX		25	/* Maximum number of commands to list when completing */
+#define SLASH_PASTE_MAX		(64 * 1024)	/* Longest paste kept, a longer one is dropped */
 
 /* Declarations for required implementation functions in slash.c */
 void slash_command_usage(struct slash *slash, struct slash_command *command);
 char *slash_history_increment(struct slash *slash, char *ptr);
+void slash_gap_close(struct slash *slash);
+bool slash_history_equal(struct slash *slash, char *entry, char *s, bool ring);
+char *slash_history_moved(struct slash *slash, char *ptr, char *removed, size_t len);
 int slash_putchar(struct slash *slash, char c);
 struct slash_command * slash_command_find(struct slash *slash, char *line, size_t linelen, char **args);
 void slash_command_description(struct slash *slash, struct slash_command *command);
 int slash_build_args(char *args, char **argv, int *argc);
+uint64_t slash_deadline_arm(struct slash *slash, unsigned int ms);
+
+/* Scope of slash_alloc() memory, see arena.c */
+struct slash_arena_mark {
+	size_t used;
+	struct slash_arena_chunk *chunks;
+};
+void slash_arena_save(struct slash *slash, struct slash_arena_mark *mark);
+void slash_arena_restore(struct slash *slash, const struct slash_arena_mark *mark);
+void slash_arena_reset(struct slash *slash);
+
+/* Variables, see vars.c */
+#define SLASH_VAR_NAME_MAX	64
+char *slash_expand(struct slash *slash, char *line);
+/* A reference to a variable which slash_expand() replaces when it is set, offsets in the line */
+struct slash_var_ref {
+	size_t offset;
+	size_t length;
+	size_t name_offset;
+	size_t name_length;
+};
+unsigned int slash_var_refs(const char *line, struct slash_var_ref *refs, unsigned int max);
+const char *slash_var_value(struct slash *slash, const char *name, size_t len);
+void slash_var_foreach(struct slash *slash, void (*func)(struct slash *slash, const char *name, const char *value));
+void slash_vars_free(struct slash *slash);
+
+/* A line looked up and split once, for a script which executes it many times. The command is
+   looked up again when commands were added or removed since, and the values of variables are
+   put into the arguments which refer to them. */
+struct slash_prepared {
+	/* The line without indentation and comment, as slash_execute() passes it to the hooks */
+	char *text;
+	struct slash_command *command;
+	unsigned int generation;
+	size_t args_offset;
+	uint32_t args_digest;
+	/* The arguments, each followed by its zero byte */
+	char *args;
+	size_t args_size;
+	int argc;
+	/* Variables in the arguments, offsets in the argument they are in, substituted each time */
+	struct slash_var_ref *refs;
+	int *ref_args;
+	unsigned int ref_count;
+	/* Offset of the first variable in text, longer command names are looked up again from there */
+	size_t ref_start;
+};
+int slash_prepare(struct slash *slash, struct slash_prepared *prepared, const char *line);
+int slash_execute_prepared(struct slash *slash, struct slash_prepared *prepared, char *line);
+void slash_prepared_free(struct slash_prepared *prepared);
+
+/* Scripts of the run command, see script.c */
+struct slash_script;
+struct slash_script *slash_script_compile(struct slash *slash, char *source);
+int slash_script_load(struct slash *slash, const char *filename, char *path, size_t path_size, struct slash_script **script);
+int slash_script_exec(struct slash *slash, const struct slash_script *script, int printcmd);
+void slash_script_free(struct slash_script *script);
+
+/* Fuzzy completion, see fuzzy.c */
+unsigned int slash_fuzzy_find(struct slash *slash, const char *query, size_t len,
+							  struct slash_command **best, unsigned int max, unsigned int *total);
+void slash_fuzzy_free(struct slash *slash);
+
+/* Completion state kept between Tabs, see completer.c */
+void slash_completion_free(struct slash *slash);
+
+/* Asynchronous completers, see complete_async.c */
+int slash_async_wait(struct slash *slash);
+void slash_async_free(struct slash *slash);
+
+/* Listing of all commands, see help.c */
+int slash_help_list(struct slash *slash);
+void slash_help_free(struct slash *slash);
+
+/* Search of the names and help of the commands, see apropos.c */
+int slash_apropos(struct slash *slash, char **words, int count);
+void slash_apropos_free(struct slash *slash);
+
+/* Suggestions for unknown commands, see suggest.c */
+void slash_suggest(struct slash *slash, const char *line);
+void slash_suggest_free(struct slash *slash);
+
+/* Hints from the history, see autosuggest.c */
+void slash_autosuggest_add(struct slash *slash, char *entry);
+void slash_autosuggest_remove(struct slash *slash, char *entry);
+void slash_autosuggest_moved(struct slash *slash, char *removed, size_t len);
+const char *slash_autosuggest(struct slash *slash, size_t *length);
+void slash_autosuggest_free(struct slash *slash);
+
+/* Set of the history entries, see history_unique.c */
+void slash_history_unique_add(struct slash *slash, char *entry);
+char *slash_history_unique_find(struct slash *slash, char *line);
+void slash_history_unique_remove(struct slash *slash, char *entry);
+void slash_history_unique_moved(struct slash *slash, char *removed, size_t len);
+void slash_history_unique_free(struct slash *slash);
+
+/* Dense ids of executed commands, for the statistics and the trace, see command_id.c.
+   Also the number of statistics entries, commands beyond it are counted as overflow. */
+#ifndef SLASH_COMMAND_ID_MAX
+#define SLASH_COMMAND_ID_MAX	2048
+#endif
+#define SLASH_COMMAND_ID_NAME_SIZE	48
+int slash_command_id(const struct slash_command *command);
+void slash_command_id_drop(const struct slash_command *command);
+const char *slash_command_id_name(int id);
+unsigned int slash_command_id_count(void);
+
+/* Keep the APM holding an address loaded while it is used outside of a read-side section, see apm.c */
+void *slash_apm_pin(const void *addr);
+void slash_apm_unpin(void *pin);
 
 /* Define and initialize section variables */
 /* __attribute__((visibility("hidden"))) prevents the section symbols from linking with
@@ -0,0 +1,127 @@
+#include <slash/slash.h>
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "builtins.h"
+
+/* Commands get a dense id the first time they are executed, for the latency statistics
+   and the execution trace. The ids are found by command pointer through an open addressing
+   table, filled lock-free, and the names are copied so they outlive unloaded APMs.
+   An id belongs to a name: a command replacing another one of the same name, or the same
+   command of an APM loaded again, gets the id of the previous one. */
+
+_Static_assert(SLASH_COMMAND_ID_MAX < UINT16_MAX, "the trace records ids in 16 bits");
+
+/* Slots of removed commands are not reused, leave room for APMs being loaded again */
+#define SLASH_COMMAND_ID_MAP_SIZE (SLASH_COMMAND_ID_MAX * 4)
+
+/* Key of a slot whose command was removed from the list, skipped by lookups */
+#define SLASH_COMMAND_ID_DROPPED ((const struct slash_command *) 1)
+
+/* Map values: 0 while the id is being set up, -1 when all ids are used, else id + 1 */
+#define SLASH_COMMAND_ID_PENDING 0
+#define SLASH_COMMAND_ID_FULL (-1)
+
+static _Atomic(const struct slash_command *) slash_command_id_keys[SLASH_COMMAND_ID_MAP_SIZE];
+static _Atomic int slash_command_id_values[SLASH_COMMAND_ID_MAP_SIZE];
+static char slash_command_id_names[SLASH_COMMAND_ID_MAX][SLASH_COMMAND_ID_NAME_SIZE];
+static _Atomic unsigned char slash_command_id_named[SLASH_COMMAND_ID_MAX];
+static _Atomic unsigned int slash_command_id_next;
+
+static bool slash_command_id_is(int id, const struct slash_command * command) {
+	return strncmp(slash_command_id_names[id], command->name, SLASH_COMMAND_ID_NAME_SIZE - 1) == 0;
+}
+
+static int slash_command_id_new(const struct slash_command * command) {
+
+	/* Only when a command is executed for the first time */
+	unsigned int count = slash_command_id_count();
+	for (unsigned int id = 0; id < count; id++) {
+		if (atomic_load_explicit(&slash_command_id_named[id], memory_order_acquire) && slash_command_id_is(id, command))
+			return id + 1;
+	}
+
+	unsigned int id = atomic_load_explicit(&slash_command_id_next, memory_order_relaxed);
+	do {
+		if (id >= SLASH_COMMAND_ID_MAX)
+			return SLASH_COMMAND_ID_FULL;
+	} while (!atomic_compare_exchange_weak_explicit(&slash_command_id_next, &id, id + 1,
+													memory_order_relaxed, memory_order_relaxed));
+
+	snprintf(slash_command_id_names[id], SLASH_COMMAND_ID_NAME_SIZE, "%s", command->name);
+	atomic_store_explicit(&slash_command_id_named[id], 1, memory_order_release);
+
+	return id + 1;
+}
+
+static size_t slash_command_id_slot(const struct slash_command * command) {
+	return ((uintptr_t) command >> 4) * 2654435761u % SLASH_COMMAND_ID_MAP_SIZE;
+}
+
+int slash_command_id(const struct slash_command * command) {
+
+	size_t slot = slash_command_id_slot(command);
+
+	for (size_t probe = 0; probe < SLASH_COMMAND_ID_MAP_SIZE; probe++, slot = (slot + 1) % SLASH_COMMAND_ID_MAP_SIZE) {
+		const struct slash_command * key = atomic_load_explicit(&slash_command_id_keys[slot], memory_order_acquire);
+
+		if (key == NULL) {
+			if (atomic_compare_exchange_strong_explicit(&slash_command_id_keys[slot], &key, command,
+														memory_order_acq_rel, memory_order_acquire)) {
+				int value = slash_command_id_new(command);
+				atomic_store_explicit(&slash_command_id_values[slot], value, memory_order_release);
+				return value > 0 ? value - 1 : -1;
+			}
+			/* Lost the slot, key is now the winner */
+		}
+		if (key != command)
+			continue;
+
+		/* Another thread may still be setting up the id */
+		int value;
+		while ((value = atomic_load_explicit(&slash_command_id_values[slot], memory_order_acquire)) == SLASH_COMMAND_ID_PENDING)
+			;
+		if (value < 0)
+			return -1;
+
+		/* A command still executing while it was removed may have entered its address again,
+		   which now belongs to a command of another APM */
+		if (!slash_command_id_is(value - 1, command)) {
+			atomic_compare_exchange_strong_explicit(&slash_command_id_keys[slot], &key, SLASH_COMMAND_ID_DROPPED,
+													memory_order_acq_rel, memory_order_relaxed);
+			continue;
+		}
+
+		return value - 1;
+	}
+
+	return -1;
+}
+
+void slash_command_id_drop(const struct slash_command * command) {
+
+	size_t slot = slash_command_id_slot(command);
+
+	for (size_t probe = 0; probe < SLASH_COMMAND_ID_MAP_SIZE; probe++, slot = (slot + 1) % SLASH_COMMAND_ID_MAP_SIZE) {
+		const struct slash_command * key = atomic_load_explicit(&slash_command_id_keys[slot], memory_order_acquire);
+		if (key == NULL)
+			return;
+		if (key == command) {
+			atomic_compare_exchange_strong_explicit(&slash_command_id_keys[slot], &key, SLASH_COMMAND_ID_DROPPED,
+													memory_order_acq_rel, memory_order_relaxed);
+			return;
+		}
+	}
+}
+
+const char * slash_command_id_name(int id) {
+	return slash_command_id_names[id];
+}
+
+unsigned int slash_command_id_count(void) {
+	unsigned int count = atomic_load_explicit(&slash_command_id_next, memory_order_acquire);
+	return count < SLASH_COMMAND_ID_MAX ? count : SLASH_COMMAND_ID_MAX;
+}
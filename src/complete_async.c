@@ -0,0 +1,447 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <slash/slash.h>
+#include <slash/completer.h>
+
+#include "builtins.h"
+
+#ifdef SLASH_ASYNC
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#endif
+
+#define SLASH_ASYNC_CACHE_SIZE		16
+#define SLASH_ASYNC_TIMEOUT_MS		3000
+#define SLASH_ASYNC_TTL_MS			10000
+
+/* Candidates fetched for a line, until they expire */
+struct slash_async_result {
+	const struct slash_async_completer *completer;
+	char *line;
+	char *words;
+	int count;
+	uint64_t time_ns;
+};
+
+#ifdef SLASH_ASYNC
+/* A fetch running on its own thread, freed by the last of the thread and the instance to let go of it */
+struct slash_async_job {
+	atomic_int refs;
+	atomic_bool done;
+	const struct slash_async_completer *completer;
+	/* The APM of fetch(), kept loaded until it returns */
+	void *pin;
+	int wake_fd;
+	uint64_t deadline_ns;
+	int count;
+	char *line;
+	char words[SLASH_ASYNC_RESULT_SIZE];
+	struct slash_async_job *next;
+};
+#endif
+
+struct slash_async {
+	struct slash_async_result cache[SLASH_ASYNC_CACHE_SIZE];
+#ifdef SLASH_ASYNC
+	/* Jobs not collected yet, and the one the line editor waits for */
+	struct slash_async_job *jobs;
+	struct slash_async_job *pending;
+	int wake[2];
+#endif
+};
+
+static uint64_t slash_async_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static struct slash_async *slash_async_get(struct slash *slash)
+{
+	if (slash->async)
+		return slash->async;
+
+	struct slash_async *async = calloc(1, sizeof(*async));
+	if (!async)
+		return NULL;
+
+#ifdef SLASH_ASYNC
+	/* A socket rather than a pipe, a late job must not raise SIGPIPE once the instance is gone */
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, async->wake) < 0) {
+		free(async);
+		return NULL;
+	}
+	fcntl(async->wake[0], F_SETFL, fcntl(async->wake[0], F_GETFL) | O_NONBLOCK);
+	fcntl(async->wake[1], F_SETFL, fcntl(async->wake[1], F_GETFL) | O_NONBLOCK);
+#endif
+
+	slash->async = async;
+
+	return async;
+}
+
+/* Candidates for the last word of a line also complete the lines extending that word */
+static bool slash_async_covers(const char *key, const char *line)
+{
+	size_t len = strlen(key);
+	return strncmp(key, line, len) == 0 && strchr(line + len, ' ') == NULL;
+}
+
+static struct slash_async_result *slash_async_lookup(struct slash_async *async,
+													 const struct slash_async_completer *completer, const char *line)
+{
+	uint64_t now = slash_async_now();
+	unsigned int ttl_ms = completer->ttl_ms ? completer->ttl_ms : SLASH_ASYNC_TTL_MS;
+
+	struct slash_async_result *best = NULL;
+	for (int i = 0; i < SLASH_ASYNC_CACHE_SIZE; i++) {
+		struct slash_async_result *result = &async->cache[i];
+		if (!result->line || result->completer != completer || !slash_async_covers(result->line, line))
+			continue;
+		if (now - result->time_ns >= ttl_ms * 1000000ull)
+			continue;
+		if (!best || strlen(result->line) > strlen(best->line))
+			best = result;
+	}
+
+	return best;
+}
+
+/* Keep the result of a fetch, in place of the same line or else the oldest entry */
+static void slash_async_store(struct slash_async *async, const struct slash_async_completer *completer,
+							  const char *line, const char *words, int count)
+{
+	struct slash_async_result *result = &async->cache[0];
+	for (int i = 0; i < SLASH_ASYNC_CACHE_SIZE; i++) {
+		struct slash_async_result *entry = &async->cache[i];
+		if (entry->line && entry->completer == completer && strcmp(entry->line, line) == 0) {
+			result = entry;
+			break;
+		}
+		if (entry->time_ns < result->time_ns)
+			result = entry;
+	}
+
+	/* The words end with the terminator of the last one */
+	const char *end = words;
+	for (int i = 0; i < count; i++)
+		end += strlen(end) + 1;
+
+	size_t line_size = strlen(line) + 1;
+	size_t words_size = end - words;
+	char *data = malloc(line_size + words_size);
+	if (!data)
+		return;
+	memcpy(data, line, line_size);
+	memcpy(data + line_size, words, words_size);
+
+	free(result->line);
+	result->completer = completer;
+	result->line = data;
+	result->words = data + line_size;
+	result->count = count;
+	result->time_ns = slash_async_now();
+}
+
+/* Complete the last word of the line from the candidates, like the long options of a command */
+static void slash_async_apply(struct slash *slash, const char *words, int count)
+{
+	char *token = slash->buffer + slash->length;
+	while (token > slash->buffer && *(token - 1) != ' ')
+		token--;
+	size_t token_len = strlen(token);
+
+	const char *match = NULL;
+	size_t prefix_len = 0;
+	int matches = 0;
+	const char *word = words;
+	for (int i = 0; i < count; i++, word += strlen(word) + 1) {
+		if (strncmp(word, token, token_len) != 0)
+			continue;
+		if (matches++ == 0) {
+			match = word;
+			prefix_len = strlen(word);
+		} else {
+			prefix_len = slash_min(prefix_len, (size_t) slash_prefix_length(match, word));
+		}
+	}
+
+	if (matches == 0) {
+		slash_bell(slash);
+		return;
+	}
+
+	if (matches > 1) {
+		slash_printf(slash, "\n");
+		int shown = 0;
+		word = words;
+		for (int i = 0; i < count; i++, word += strlen(word) + 1) {
+			if (strncmp(word, token, token_len) == 0 && shown++ < SLASH_SHOW_MAX)
+				slash_printf(slash, "%s\n", word);
+		}
+		if (shown > SLASH_SHOW_MAX)
+			slash_printf(slash, "... %d more\n", shown - SLASH_SHOW_MAX);
+	}
+
+	/* Fill in the common part, and the separator if the word is complete */
+	size_t offset = token - slash->buffer;
+	const char *suffix = matches == 1 ? " " : "";
+	if (offset + prefix_len + strlen(suffix) >= slash->line_size)
+		return;
+	memcpy(slash->buffer + offset, match, prefix_len);
+	strcpy(slash->buffer + offset + prefix_len, suffix);
+	slash->cursor = slash->length = strlen(slash->buffer);
+}
+
+#ifdef SLASH_ASYNC
+static void slash_async_release(struct slash_async_job *job)
+{
+	if (atomic_fetch_sub(&job->refs, 1) > 1)
+		return;
+
+	close(job->wake_fd);
+	free(job->line);
+	free(job);
+}
+
+static void *slash_async_worker(void *arg)
+{
+	struct slash_async_job *job = arg;
+
+	job->count = job->completer->fetch(job->line, job->words, sizeof(job->words),
+									   job->completer->timeout_ms ? job->completer->timeout_ms : SLASH_ASYNC_TIMEOUT_MS);
+#ifdef SLASH_HAVE_APM
+	slash_apm_unpin(job->pin);
+#endif
+	atomic_store(&job->done, true);
+
+	/* Wake up the line editor, see slash_async_wait() */
+	char c = 0;
+	send(job->wake_fd, &c, 1, MSG_NOSIGNAL);
+	slash_async_release(job);
+
+	return NULL;
+}
+
+static struct slash_async_job *slash_async_start(struct slash_async *async, const struct slash_async_completer *completer,
+												 const char *line)
+{
+	struct slash_async_job *job = calloc(1, sizeof(*job));
+	if (!job)
+		return NULL;
+
+	job->line = strdup(line);
+	job->wake_fd = dup(async->wake[1]);
+	if (!job->line || job->wake_fd < 0) {
+		if (job->wake_fd >= 0)
+			close(job->wake_fd);
+		free(job->line);
+		free(job);
+		return NULL;
+	}
+	job->completer = completer;
+	job->deadline_ns = slash_async_now() +
+		(completer->timeout_ms ? completer->timeout_ms : SLASH_ASYNC_TIMEOUT_MS) * 1000000ull;
+	atomic_init(&job->refs, 2);
+	atomic_init(&job->done, false);
+#ifdef SLASH_HAVE_APM
+	/* Completers run inside a read-side section of the command list, so the APM of the completer
+	   is still loaded here. Pin only that one, the thread does not hold up slash_list_synchronize(). */
+	job->pin = slash_apm_pin((const void *) completer->fetch);
+#endif
+
+	pthread_t thread;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	int ret = pthread_create(&thread, &attr, slash_async_worker, job);
+	pthread_attr_destroy(&attr);
+	if (ret != 0) {
+#ifdef SLASH_HAVE_APM
+		slash_apm_unpin(job->pin);
+#endif
+		close(job->wake_fd);
+		free(job->line);
+		free(job);
+		return NULL;
+	}
+
+	job->next = async->jobs;
+	async->jobs = job;
+
+	return job;
+}
+
+/* Move the results of finished jobs to the cache, also those which missed their deadline */
+static void slash_async_collect(struct slash_async *async)
+{
+	char buf[16];
+	while (read(async->wake[0], buf, sizeof(buf)) > 0)
+		;
+
+	struct slash_async_job **prev = &async->jobs;
+	while (*prev) {
+		struct slash_async_job *job = *prev;
+		if (!atomic_load(&job->done) || job == async->pending) {
+			prev = &job->next;
+			continue;
+		}
+		if (job->count >= 0)
+			slash_async_store(async, job->completer, job->line, job->words, job->count);
+		*prev = job->next;
+		slash_async_release(job);
+	}
+}
+
+static struct slash_async_job *slash_async_running(struct slash_async *async,
+												   const struct slash_async_completer *completer, const char *line)
+{
+	for (struct slash_async_job *job = async->jobs; job; job = job->next) {
+		if (job->completer == completer && slash_async_covers(job->line, line))
+			return job;
+	}
+
+	return NULL;
+}
+
+int slash_async_wait(struct slash *slash)
+{
+	struct slash_async *async = slash->async;
+	if (!async || !async->pending)
+		return 0;
+
+	struct slash_async_job *job = async->pending;
+	if (!atomic_load(&job->done)) {
+		uint64_t now = slash_async_now();
+		int timeout = now < job->deadline_ns ? (int) ((job->deadline_ns - now + 999999) / 1000000) : 0;
+
+		struct pollfd fds[2] = {
+			{ .fd = slash->fd_read, .events = POLLIN },
+			{ .fd = async->wake[0], .events = POLLIN },
+		};
+		int ret = poll(fds, 2, timeout);
+		if (ret < 0 && errno == EINTR)
+			return 0;
+		if (ret == 0) {
+			/* Given up on, the result still goes to the cache when it comes */
+			async->pending = NULL;
+			slash_bell(slash);
+			return 0;
+		}
+		if (!(fds[1].revents & POLLIN))
+			return 0;
+		if (!atomic_load(&job->done)) {
+			slash_async_collect(async);
+			return 0;
+		}
+	}
+
+	/* The line is read as a whole from here */
+	slash_gap_close(slash);
+
+	/* Complete again with the result, unless the line changed other than by typing more of the last word.
+	 * The completion may have been for the end of the line only, after "watch" for example. */
+	size_t word = slash->length;
+	while (word > 0 && slash->buffer[word - 1] != ' ')
+		word--;
+	const char *space = strrchr(job->line, ' ');
+	size_t job_word = space ? (size_t) (space - job->line) + 1 : 0;
+	size_t line_len = strlen(job->line);
+	bool same = word >= job_word && word - job_word + line_len <= slash->length &&
+		memcmp(slash->buffer + word - job_word, job->line, line_len) == 0;
+	bool failed = job->count < 0;
+	async->pending = NULL;
+	slash_async_collect(async);
+	if (!same)
+		return 0;
+
+	/* A failed fetch is not cached, completing again would start the next one right away */
+	if (failed) {
+		slash_bell(slash);
+		return 0;
+	}
+
+	slash_complete(slash);
+
+	return 1;
+}
+#endif
+
+void slash_complete_async(struct slash *slash, char *token, const struct slash_async_completer *completer)
+{
+	(void) token;
+
+	struct slash_async *async = slash_async_get(slash);
+	if (!async) {
+		slash_bell(slash);
+		return;
+	}
+
+	const char *line = slash->buffer;
+#ifdef SLASH_ASYNC
+	slash_async_collect(async);
+#endif
+
+	struct slash_async_result *result = slash_async_lookup(async, completer, line);
+	if (result) {
+		slash_async_apply(slash, result->words, result->count);
+		return;
+	}
+
+#ifdef SLASH_ASYNC
+	/* Pending, the line is completed again by slash_async_wait() when the result comes */
+	struct slash_async_job *job = slash_async_running(async, completer, line);
+	if (!job)
+		job = slash_async_start(async, completer, line);
+	if (job) {
+		async->pending = job;
+		return;
+	}
+#endif
+
+	/* Without threads, fetch right away */
+	char *words = slash_alloc(slash, SLASH_ASYNC_RESULT_SIZE);
+	if (!words) {
+		slash_bell(slash);
+		return;
+	}
+	int count = completer->fetch(line, words, SLASH_ASYNC_RESULT_SIZE,
+								 completer->timeout_ms ? completer->timeout_ms : SLASH_ASYNC_TIMEOUT_MS);
+	if (count < 0) {
+		slash_bell(slash);
+		return;
+	}
+	slash_async_store(async, completer, line, words, count);
+	slash_async_apply(slash, words, count);
+}
+
+void slash_async_free(struct slash *slash)
+{
+	struct slash_async *async = slash->async;
+	if (!async)
+		return;
+
+#ifdef SLASH_ASYNC
+	/* Running jobs free themselves when they finish */
+	while (async->jobs) {
+		struct slash_async_job *job = async->jobs;
+		async->jobs = job->next;
+		slash_async_release(job);
+	}
+	close(async->wake[0]);
+	close(async->wake[1]);
+#endif
+
+	for (int i = 0; i < SLASH_ASYNC_CACHE_SIZE; i++)
+		free(async->cache[i].line);
+	free(async);
+	slash->async = NULL;
+}
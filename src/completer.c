@@ -7,7 +7,6 @@
 #include <inttypes.h>
 #include <limits.h>
 #include <dirent.h>
-#include <sys/queue.h>
 
 #include "builtins.h"
 
@@ -75,13 +74,14 @@ void slash_completer_skip_flagged_prefix(struct slash *slash, char * tgt_prefix)
 
     /* if slash buffer begins with tgt_prefix */
 	if (!strncmp(slash->buffer, tgt_prefix, prefix_len)) {
-		char * const tmp_buf = calloc(1, buffer_len+1);
+		char * const tmp_buf = slash_alloc(slash, buffer_len+1);
 
         if (tmp_buf == NULL) {
             fprintf(stderr, "Memory allocation error\n");
 			return;
         }
 
+        memset(tmp_buf, 0, buffer_len+1);
         strncpy(tmp_buf, slash->buffer + prefix_len, buffer_len-prefix_len);
 		char * token = strtok(tmp_buf, " ");
 		
@@ -89,6 +89,7 @@ void slash_completer_skip_flagged_prefix(struct slash *slash, char * tgt_prefix)
 		int consecutive_ctr = !strcmp(tgt_prefix, "") ? 0 : 1;
         if(!token) {
             slash->buffer = slash->buffer + prefix_len + 1;
+            slash->line_size -= prefix_len + 1;
             slash->length = strlen(slash->buffer);
             slash->cursor = slash->length;
         } else {
@@ -100,6 +101,7 @@ void slash_completer_skip_flagged_prefix(struct slash *slash, char * tgt_prefix)
                     if (consecutive_ctr == 2) {
                         /* move buffer pointer ahead of "tgt_prefix [OPTIONS] ..." */
                         slash->buffer = slash->buffer + (prefix_len+(token-tmp_buf));
+                        slash->line_size -= prefix_len + (token - tmp_buf);
                         slash->length = strlen(slash->buffer);
                         slash->cursor = slash->length;
                         break;
@@ -112,12 +114,12 @@ void slash_completer_skip_flagged_prefix(struct slash *slash, char * tgt_prefix)
                 token = strtok(NULL, " ");
             }
         }
-		free(tmp_buf);
 	}
 }
 
 void slash_completer_revert_skip(struct slash *slash, char * orig_slash_buf) {
     /* return buffer to original mem address */
+	slash->line_size += slash->buffer - orig_slash_buf;
 	slash->buffer = orig_slash_buf;
 	slash->length = strlen(slash->buffer);
 	slash->cursor = slash->length;
@@ -136,10 +138,19 @@ int slash_prefix_length(const char *s1, const char *s2)
 	return len;
 }
 
-SLIST_HEAD( completion_list, completion_entry );
-struct completion_entry {
-    struct slash_command * cmd;
-    SLIST_ENTRY(completion_entry) list;
+/* Candidates of the last completion, narrowed while the line grows, see slash_complete_candidates() */
+struct slash_completion {
+    bool valid;
+    unsigned int generation;
+    char *prefix;
+    size_t prefix_len;
+    size_t prefix_size;
+    unsigned int count;
+    unsigned int size;
+    struct slash_command **cmds;
+    /* Candidate put in the line by the last Tab when cycling, -1 otherwise */
+    int cycle;
+    int depth;
 };
 
 slash_completer_func_t slash_global_completer = NULL;
@@ -152,11 +163,23 @@ static void call_cmd_completion(struct slash *slash, struct slash_command * cmd)
         slash->cursor++;
         slash->length++;
     }
-    char *argv[SLASH_ARG_MAX];
-    slash->argv = argv;
-    char args[slash->line_size];
+    char *argv_stack[SLASH_ARG_MAX + 1], **argv = argv_stack;
+    char *args = slash_alloc(slash, slash->line_size);
+    if (!args) {
+        slash_bell(slash);
+        return;
+    }
     /* Skip the found command name when building the command line */
     strcpy(args, slash->buffer + cmd_len + 1);
+    slash_build_args(args, NULL, &slash->argc);
+    if (slash->argc > SLASH_ARG_MAX) {
+        argv = slash_alloc(slash, (slash->argc + 1) * sizeof(*argv));
+        if (!argv) {
+            slash_bell(slash);
+            return;
+        }
+    }
+    slash->argv = argv;
     slash_build_args(args, slash->argv, &slash->argc);
     cmd->completer(slash, slash->buffer + cmd_len + 1);
     if (slash_global_completer) {
@@ -164,6 +187,201 @@ static void call_cmd_completion(struct slash *slash, struct slash_command * cmd)
     }
 }
 
+/* Complete the long option being typed at the end of the line from the option schema of the command */
+static bool slash_complete_opts(struct slash *slash, struct slash_command * cmd) {
+    size_t cmd_len = strlen(cmd->name);
+    if (slash->cursor != slash->length || slash->length <= cmd_len + 1)
+        return false;
+
+    char *token = slash->buffer + slash->length;
+    while (token > slash->buffer + cmd_len && *(token - 1) != ' ')
+        token--;
+    if (strncmp(token, "--", 2) != 0 || strchr(token, '=') != NULL)
+        return false;
+
+    const char *name = token + 2;
+    size_t name_len = strlen(name);
+    const struct slash_opt *match = NULL;
+    size_t matches = 0;
+    size_t prefix_len = 0;
+    for (const struct slash_opt *opt = cmd->opts; opt->short_opt || opt->long_opt; opt++) {
+        if (!opt->long_opt || strncmp(opt->long_opt, name, name_len) != 0)
+            continue;
+        if (matches++ == 0) {
+            match = opt;
+            prefix_len = strlen(opt->long_opt);
+        } else {
+            prefix_len = slash_min(prefix_len, (size_t) slash_prefix_length(match->long_opt, opt->long_opt));
+        }
+    }
+
+    if (matches == 0) {
+        slash_bell(slash);
+        return true;
+    }
+
+    if (matches > 1) {
+        slash_printf(slash, "\n");
+        for (const struct slash_opt *opt = cmd->opts; opt->short_opt || opt->long_opt; opt++) {
+            if (opt->long_opt && strncmp(opt->long_opt, name, name_len) == 0)
+                slash_printf(slash, "--%s%s\n", opt->long_opt, opt->arg_desc ? "=" : "");
+        }
+    }
+
+    /* Fill in the common part, and the separator if the option is complete */
+    size_t offset = name - slash->buffer;
+    const char *suffix = matches == 1 ? (match->arg_desc ? "=" : " ") : "";
+    if (offset + prefix_len + strlen(suffix) >= slash->line_size)
+        return true;
+    memcpy(slash->buffer + offset, match->long_opt, prefix_len);
+    strcpy(slash->buffer + offset + prefix_len, suffix);
+    slash->cursor = slash->length = strlen(slash->buffer);
+
+    return true;
+}
+
+static bool slash_complete_match(struct slash_command *cmd, const char *buffer, size_t len) {
+    size_t cmd_len = strlen(cmd->name);
+    if (strncmp(buffer, cmd->name, slash_min(len, cmd_len)) != 0)
+        return false;
+    /* A command shorter than the line only matches when it completes its arguments */
+    return len <= cmd_len || cmd->completer || cmd->opts;
+}
+
+/**
+ * Find the commands matching the first len characters of the line, called with the command list read locked.
+ * The line usually grew since the previous Tab, then only the previous candidates are checked again instead
+ * of the whole command list. Returns the number of candidates, or -1 when out of memory.
+ */
+static int slash_complete_candidates(struct slash *slash, size_t len) {
+    struct slash_completion *state = slash->completion;
+    unsigned int generation = slash_list_generation();
+
+    if (state->valid && state->generation == generation &&
+        state->prefix_len <= len && memcmp(state->prefix, slash->buffer, state->prefix_len) == 0) {
+        unsigned int count = 0;
+        for (unsigned int i = 0; i < state->count; i++) {
+            if (slash_complete_match(state->cmds[i], slash->buffer, len))
+                state->cmds[count++] = state->cmds[i];
+        }
+        state->count = count;
+    } else {
+        state->valid = false;
+        state->count = 0;
+        struct slash_command *cmd;
+        slash_list_iterator i = {0};
+        while ((cmd = slash_list_iterate(&i)) != NULL) {
+            if (!slash_complete_match(cmd, slash->buffer, len))
+                continue;
+            if (state->count == state->size) {
+                unsigned int size = state->size ? state->size * 2 : 64;
+                struct slash_command **cmds = realloc(state->cmds, size * sizeof(*cmds));
+                if (!cmds)
+                    return -1;
+                state->cmds = cmds;
+                state->size = size;
+            }
+            state->cmds[state->count++] = cmd;
+        }
+        state->generation = generation;
+        state->valid = true;
+    }
+
+    memcpy(state->prefix, slash->buffer, len);
+    state->prefix_len = len;
+    state->cycle = -1;
+
+    return state->count;
+}
+
+/* Put the next candidate in the line, when Tab is pressed again on a candidate put there by Tab */
+static bool slash_complete_cycle(struct slash *slash) {
+    struct slash_completion *state = slash->completion;
+
+    if (state->cycle < 0 || state->depth > 1 || slash->last_char != '\t' ||
+        state->generation != slash_list_generation() ||
+        strcmp(slash->buffer, state->cmds[state->cycle]->name) != 0)
+        return false;
+
+    /* Commands shorter than the completed prefix would cut the line */
+    unsigned int next = state->cycle;
+    do {
+        next = (next + 1) % state->count;
+    } while (strlen(state->cmds[next]->name) < state->prefix_len);
+
+    state->cycle = next;
+    strncpy(slash->buffer, state->cmds[next]->name, slash->line_size - 1);
+    slash->buffer[slash->line_size - 1] = '\0';
+    slash->cursor = slash->length = strlen(slash->buffer);
+
+    return true;
+}
+
+static struct slash_completion *slash_completion_get(struct slash *slash) {
+    if (!slash->completion) {
+        struct slash_completion *state = calloc(1, sizeof(*state));
+        if (!state)
+            return NULL;
+        state->cycle = -1;
+        slash->completion = state;
+    }
+
+    /* The line buffer may have grown since */
+    struct slash_completion *state = slash->completion;
+    if (state->prefix_size < slash->line_size) {
+        char *prefix = realloc(state->prefix, slash->line_size);
+        if (!prefix)
+            return NULL;
+        state->prefix = prefix;
+        state->prefix_size = slash->line_size;
+    }
+
+    return state;
+}
+
+void slash_completion_free(struct slash *slash) {
+    if (!slash->completion)
+        return;
+
+    free(slash->completion->prefix);
+    free(slash->completion->cmds);
+    free(slash->completion);
+    slash->completion = NULL;
+}
+
+/* Offer the commands containing the typed characters in order, "pgs" for "param get serial" */
+static bool slash_complete_fuzzy(struct slash *slash) {
+    struct slash_command *best[SLASH_SHOW_MAX];
+    unsigned int total;
+    char *args;
+
+    /* Not when a command is typed already, and only its arguments are left */
+    if (slash_command_find(slash, slash->buffer, slash->length, &args) != NULL)
+        return false;
+
+    unsigned int found = slash_fuzzy_find(slash, slash->buffer, slash->length, best, SLASH_SHOW_MAX, &total);
+
+    if (found == 0)
+        return false;
+
+    if (found == 1) {
+        strncpy(slash->buffer, best[0]->name, slash->line_size - 1);
+        slash->buffer[slash->line_size - 1] = '\0';
+        slash->cursor = slash->length = strlen(slash->buffer);
+        return true;
+    }
+
+    slash_printf(slash, "\n");
+    for (unsigned int i = 0; i < found; i++) {
+        slash_command_description(slash, best[i]);
+    }
+    if (total > found) {
+        slash_printf(slash, "... %u more\n", total - found);
+    }
+
+    return true;
+}
+
 /**
  * @brief For tab auto completion, calls other completion functions when matched command has them
  *
@@ -171,16 +389,17 @@ static void call_cmd_completion(struct slash *slash, struct slash_command * cmd)
  */
 void slash_complete(struct slash *slash)
 {
-	int matches = 0;
-	struct slash_command * cmd;
-    struct completion_list completions;
-    struct completion_entry *completion = NULL;
-    struct completion_entry *cur_completion;
-    SLIST_INIT( &completions );
-	slash_list_iterator i = {0};
-    size_t cmd_len;
+	int matches;
+    struct slash_command *completion = NULL;
+    struct slash_completion *state = slash_completion_get(slash);
+    if (!state) {
+        slash_bell(slash);
+        return;
+    }
+    /* The completers use slash_alloc() memory, released at the end */
+    struct slash_arena_mark mark;
+    slash_arena_save(slash, &mark);
     size_t cur_prefix;
-    int cmd_match;
     {
         /* Let's take care of multiple consecutive trailing spaces */
         size_t nof_trailing_spaces = 0;
@@ -194,56 +413,58 @@ void slash_complete(struct slash *slash)
         }
     }
     size_t len_to_compare_to = slash->length>0?slash->buffer[slash->length-1] == ' '?slash->length-1:slash->length:0;
-    while ((cmd = slash_list_iterate(&i)) != NULL) {
-        cmd_len = strlen(cmd->name);
-        cmd_match = strncmp(slash->buffer, cmd->name, slash_min(len_to_compare_to, cmd_len));
-        /* Do we have an exact match on the buffer ?*/
-        if (cmd_match == 0) {
-            if((cmd_len < len_to_compare_to && cmd->completer) || (len_to_compare_to <= cmd_len)) {
-                completion = malloc(sizeof(struct completion_entry));
-                if (completion) {
-                    matches++;
-                    completion->cmd = cmd;
-                    SLIST_INSERT_HEAD(&completions, completion, list);
-                }
-            }
-        }
+    /* Matched commands are referenced until the end of the completion */
+    slash_list_read_lock();
+    /* Completers of the matched command may complete again, for the rest of the line */
+    state->depth++;
+    if (slash_complete_cycle(slash)) {
+        goto out;
     }
-    if(matches > 1) {
-        /* We only print all commands over 1 match here */
-        slash_printf(slash, "\n");
+    matches = slash_complete_candidates(slash, len_to_compare_to);
+    if (matches < 0) {
+        slash_bell(slash);
+        goto out;
     }
-    struct completion_entry *prev_completion = NULL;
     size_t prefix_len = INT_MAX;
-
-    SLIST_FOREACH(cur_completion, &completions, list) {
+    for (int i = 1; i < matches; i++) {
         /* Compute the length of prefix common to all completions */
-        if (prev_completion != 0) {
-            cur_prefix = (size_t) slash_prefix_length(prev_completion->cmd->name, cur_completion->cmd->name);
-            if(cur_prefix < prefix_len) {
-                prefix_len = cur_prefix;
-                completion = cur_completion;
-            }
+        cur_prefix = (size_t) slash_prefix_length(state->cmds[i - 1]->name, state->cmds[i]->name);
+        if(cur_prefix < prefix_len) {
+            prefix_len = cur_prefix;
+        }
+    }
+    if (matches > 0) {
+        completion = state->cmds[0];
+    }
+    /* When there is nothing left to fill in, Tab again puts the candidates in the line one by one */
+    bool fill = slash->length > 0 && slash->buffer[slash->length-1] != ' ' && len_to_compare_to < prefix_len;
+    bool cycle = matches > 1 && !fill && slash->last_char == '\t' && state->depth == 1;
+    if(matches > 1 && !cycle) {
+        /* We only print all commands over 1 match here */
+        slash_printf(slash, "\n");
+        for (int i = 0; i < matches && i < SLASH_SHOW_MAX; i++) {
+            slash_command_description(slash, state->cmds[i]);
         }
-        prev_completion = cur_completion;
-        if(matches > 1) {
-            slash_command_description(slash, cur_completion->cmd);
+        if (matches > SLASH_SHOW_MAX) {
+            slash_printf(slash, "... %d more\n", matches - SLASH_SHOW_MAX);
         }
     }
     if (matches == 1) {
-        /* Reassign cmd_len to the current completion as it may have changed during the loop */
-        cmd_len = strlen(completion->cmd->name);
-        if(slash->length < strlen(completion->cmd->name)) {
+        size_t cmd_len = strlen(completion->name);
+        if(slash->length < cmd_len) {
             /* The buffer uniquely completes to a longer command */
-            strncpy(slash->buffer, completion->cmd->name, slash->line_size);
+            strncpy(slash->buffer, completion->name, slash->line_size);
             slash->buffer[cmd_len] = '\0';
             slash->cursor = slash->length = strlen(slash->buffer);
         }
-        if (completion->cmd->completer) {
+        if (completion->opts && slash->complete_in_completion == true &&
+            slash_complete_opts(slash, completion)) {
+            /* Completed an option name */
+        } else if (completion->completer) {
             /* Call the matching command completer with the rest of the buffer but only if the current 
                completer allows it */
             if(slash->complete_in_completion == true) {
-                call_cmd_completion(slash, completion->cmd);
+                call_cmd_completion(slash, completion);
             }
         }
     } else if(matches > 1) {
@@ -251,26 +472,31 @@ void slash_complete(struct slash *slash)
          * if what the user typed in doesn't end with a space, we might
          * as well put all the common prefix in the buffer
          */
-        if(slash->length > 0) {
-            if(slash->buffer[slash->length-1] != ' ' && len_to_compare_to < prefix_len) {
-                strncpy(slash->buffer, completion->cmd->name, prefix_len);
-                slash->buffer[prefix_len] = '\0';
-                slash->length = prefix_len;
-                slash->cursor = prefix_len;
+        if(fill) {
+            strncpy(slash->buffer, completion->name, prefix_len);
+            slash->buffer[prefix_len] = '\0';
+            slash->length = prefix_len;
+            slash->cursor = prefix_len;
+        } else if (cycle) {
+            for (int i = 0; i < matches; i++) {
+                if (strlen(state->cmds[i]->name) >= len_to_compare_to) {
+                    state->cycle = i;
+                    strncpy(slash->buffer, state->cmds[i]->name, slash->line_size - 1);
+                    slash->buffer[slash->line_size - 1] = '\0';
+                    slash->cursor = slash->length = strlen(slash->buffer);
+                    break;
+                }
             }
         }
-    } else {
+    } else if (!slash_complete_fuzzy(slash)) {
         if (slash_global_completer) {
             slash_global_completer(slash, slash->buffer);
         }
     }
-    /* Free up the completion list we built up earlier */
-    while (!SLIST_EMPTY(&completions))
-    {
-        completion = SLIST_FIRST(&completions);
-        SLIST_REMOVE(&completions, completion, completion_entry, list);
-        free(completion);
-    }
+out:
+    state->depth--;
+    slash_list_read_unlock();
+    slash_arena_restore(slash, &mark);
 }
 
 /**
@@ -382,7 +608,7 @@ void slash_path_completer(struct slash * slash, char * token) {
                     }
                     match_list = tmp;
                 }
-                char *match_tmp = (char*)malloc(strlen(pmatch) + 3);
+                char *match_tmp = (char*)slash_alloc(slash, strlen(pmatch) + 3);
                 if(match_tmp) {
                     match_list[match_count] = match_tmp;
                     strcpy(match_list[match_count], pmatch); 
@@ -433,11 +659,7 @@ void slash_path_completer(struct slash * slash, char * token) {
 
     closedir(cwd_ptr);
 
-    /* free all memory allocated for string matches */
-    for (unsigned int i = 0; i < match_count; i++)
-    {
-        free(match_list[i]);
-    }
+    /* The matches are slash_alloc() memory, released with the completion */
     free((void*)match_list);
 }
 
@@ -464,6 +686,31 @@ void slash_watch_completer(struct slash *slash, char * token) {
     slash_complete_other_commands(slash, token, "watch");
 }
 
+/**
+ * @brief For tab auto completion when using "timeout"
+ *
+ * @param slash Slash context
+ * @param token Slash buffer after first space
+ */
+void slash_timeout_completer(struct slash *slash, char * token) {
+    // skip timeout and the number of milliseconds
+    char * command = strchr(token, ' ');
+    if (command == NULL)
+        return;
+    while (*command == ' ')
+        command++;
+
+    char * orig_slash_buffer = slash->buffer;
+    slash->line_size -= command - slash->buffer;
+    slash->buffer = command;
+    slash->length = strlen(slash->buffer);
+    slash->cursor = slash->length;
+
+    slash_complete(slash);
+
+    slash_completer_revert_skip(slash, orig_slash_buffer);
+}
+
 /**
  * @brief For tab auto completion when using "help"
  *
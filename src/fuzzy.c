@@ -0,0 +1,178 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <slash/slash.h>
+
+#include "builtins.h"
+
+/* Command names with the set of characters they contain, rebuilt when the command list changes */
+struct slash_fuzzy_entry {
+	uint64_t mask;
+	struct slash_command *cmd;
+};
+
+struct slash_fuzzy_index {
+	bool valid;
+	unsigned int generation;
+	unsigned int count;
+	unsigned int size;
+	struct slash_fuzzy_entry *entries;
+};
+
+/* Bit of a character in the mask, case insensitive */
+static uint64_t slash_fuzzy_bit(char c)
+{
+	unsigned char u = tolower((unsigned char) c);
+
+	if (u >= 'a' && u <= 'z')
+		return 1ull << (u - 'a');
+	if (u >= '0' && u <= '9')
+		return 1ull << (26 + u - '0');
+	if (u == ' ')
+		return 0;
+
+	return 1ull << (36 + u % 28);
+}
+
+static uint64_t slash_fuzzy_mask(const char *s, size_t len)
+{
+	uint64_t mask = 0;
+	for (size_t i = 0; i < len; i++)
+		mask |= slash_fuzzy_bit(s[i]);
+
+	return mask;
+}
+
+/* Called with the command list read locked */
+static int slash_fuzzy_build(struct slash *slash)
+{
+	struct slash_fuzzy_index *index = slash->fuzzy;
+
+	if (!index) {
+		index = calloc(1, sizeof(*index));
+		if (!index)
+			return -1;
+		slash->fuzzy = index;
+	}
+
+	unsigned int generation = slash_list_generation();
+	if (index->valid && index->generation == generation)
+		return 0;
+
+	index->valid = false;
+	index->count = 0;
+
+	struct slash_command *cmd;
+	slash_list_iterator i = {0};
+	while ((cmd = slash_list_iterate(&i)) != NULL) {
+		if (index->count == index->size) {
+			unsigned int size = index->size ? index->size * 2 : 256;
+			struct slash_fuzzy_entry *entries = realloc(index->entries, size * sizeof(*entries));
+			if (!entries)
+				return -1;
+			index->entries = entries;
+			index->size = size;
+		}
+		index->entries[index->count].cmd = cmd;
+		index->entries[index->count].mask = slash_fuzzy_mask(cmd->name, strlen(cmd->name));
+		index->count++;
+	}
+
+	index->generation = generation;
+	index->valid = true;
+
+	return 0;
+}
+
+void slash_fuzzy_free(struct slash *slash)
+{
+	if (!slash->fuzzy)
+		return;
+
+	free(slash->fuzzy->entries);
+	free(slash->fuzzy);
+	slash->fuzzy = NULL;
+}
+
+/**
+ * Score of name for the query, which must be a subsequence of it ignoring spaces, -1 if it is not.
+ * Characters matched at the start of a word or right after the previous match score more, skipped
+ * characters and long names score less.
+ */
+static int slash_fuzzy_score(const char *query, size_t len, const char *name)
+{
+	int score = 0;
+	int gap = 0;
+	bool consecutive = false;
+	size_t q = 0;
+
+	for (const char *c = name; *c; c++) {
+		while (q < len && query[q] == ' ')
+			q++;
+		if (q == len)
+			break;
+
+		if (tolower((unsigned char) *c) != tolower((unsigned char) query[q])) {
+			consecutive = false;
+			gap++;
+			continue;
+		}
+
+		score += 1;
+		if (c == name || *(c - 1) == ' ' || *(c - 1) == '_' || *(c - 1) == '-')
+			score += 8;
+		else if (consecutive)
+			score += 4;
+		score -= slash_min(gap, 3);
+		gap = 0;
+		consecutive = true;
+		q++;
+	}
+
+	while (q < len && query[q] == ' ')
+		q++;
+	if (q < len)
+		return -1;
+
+	return score * 16 - (int) strlen(name);
+}
+
+unsigned int slash_fuzzy_find(struct slash *slash, const char *query, size_t len,
+							  struct slash_command **best, unsigned int max, unsigned int *total)
+{
+	*total = 0;
+	if (len == 0 || max == 0 || slash_fuzzy_build(slash) < 0)
+		return 0;
+
+	struct slash_fuzzy_index *index = slash->fuzzy;
+	uint64_t mask = slash_fuzzy_mask(query, len);
+	int scores[SLASH_SHOW_MAX];
+	max = slash_min(max, (unsigned int) SLASH_SHOW_MAX);
+	unsigned int found = 0;
+
+	for (unsigned int i = 0; i < index->count; i++) {
+		/* Most commands lack one of the characters, and are rejected here */
+		if (mask & ~index->entries[i].mask)
+			continue;
+
+		int score = slash_fuzzy_score(query, len, index->entries[i].cmd->name);
+		if (score < 0)
+			continue;
+		(*total)++;
+
+		/* Keep the best ones, sorted by score */
+		if (found == max && score <= scores[max - 1])
+			continue;
+		unsigned int pos = found < max ? found++ : max - 1;
+		while (pos > 0 && scores[pos - 1] < score) {
+			scores[pos] = scores[pos - 1];
+			best[pos] = best[pos - 1];
+			pos--;
+		}
+		scores[pos] = score;
+		best[pos] = index->entries[i].cmd;
+	}
+
+	return found;
+}
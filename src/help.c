@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <slash/slash.h>
+
+#include "builtins.h"
+
+#ifdef SLASH_HAVE_TERMIOS_H
+#include <sys/ioctl.h>
+#endif
+
+#define SLASH_HELP_WIDTH	80	/* Width of the listing when the terminal does not tell */
+#define SLASH_HELP_INDENT	2	/* Indentation of the commands of a group */
+
+/* The listing of all commands, rendered again when the command list or the terminal width changes */
+struct slash_help {
+	bool valid;
+	unsigned int generation;
+	unsigned int width;
+	char *buf;
+	size_t length;
+	size_t size;
+};
+
+static unsigned int slash_help_width(struct slash *slash)
+{
+#if defined(SLASH_HAVE_TERMIOS_H) && defined(TIOCGWINSZ)
+	struct winsize ws;
+	if (ioctl(slash->fd_write, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0)
+		return ws.ws_col;
+#else
+	(void) slash;
+#endif
+	return SLASH_HELP_WIDTH;
+}
+
+static int slash_help_append(struct slash_help *help, const char *s, size_t len)
+{
+	if (help->length + len + 1 > help->size) {
+		size_t size = help->size ? help->size : 1024;
+		while (help->length + len + 1 > size)
+			size *= 2;
+		char *buf = realloc(help->buf, size);
+		if (!buf)
+			return -1;
+		help->buf = buf;
+		help->size = size;
+	}
+
+	memcpy(help->buf + help->length, s, len);
+	help->length += len;
+	help->buf[help->length] = '\0';
+
+	return 0;
+}
+
+/* Length of the group of a command, the first word of its name, 0 for a single word */
+static size_t slash_help_group(const char *name)
+{
+	const char *space = strchr(name, ' ');
+	return space ? (size_t) (space - name) : 0;
+}
+
+/**
+ * Append names[0..count) skipping skip characters of each, in columns filling the width
+ * and read top to bottom like ls.
+ */
+static int slash_help_columns(struct slash_help *help, struct slash_command **cmds, unsigned int count,
+							  size_t skip, unsigned int indent)
+{
+	size_t column = 0;
+	for (unsigned int i = 0; i < count; i++)
+		column = slash_max(column, strlen(cmds[i]->name) - skip + 2);
+
+	unsigned int columns = help->width > indent + column ? (help->width - indent) / column : 1;
+	unsigned int rows = (count + columns - 1) / columns;
+	char pad[SLASH_HELP_INDENT + 1];
+	memset(pad, ' ', sizeof(pad));
+
+	for (unsigned int row = 0; row < rows; row++) {
+		if (slash_help_append(help, pad, indent) < 0)
+			return -1;
+		for (unsigned int i = row; i < count; i += rows) {
+			const char *name = cmds[i]->name + skip;
+			size_t len = strlen(name);
+			if (slash_help_append(help, name, len) < 0)
+				return -1;
+			/* Pad to the next column, but not at the end of the line */
+			for (size_t n = len; i + rows < count && n < column; n++) {
+				if (slash_help_append(help, " ", 1) < 0)
+					return -1;
+			}
+		}
+		if (slash_help_append(help, "\n", 1) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Called with the command list read locked */
+static int slash_help_render(struct slash *slash, struct slash_help *help)
+{
+	help->length = 0;
+
+	unsigned int total = 0;
+	struct slash_command *cmd;
+	slash_list_iterator i = {0};
+	while ((cmd = slash_list_iterate(&i)) != NULL)
+		total++;
+
+	struct slash_command **cmds = slash_alloc(slash, slash_max(total, 1u) * sizeof(*cmds));
+	if (!cmds)
+		return -1;
+
+	/* The commands of one word first, the list is sorted by name */
+	unsigned int count = 0;
+	slash_list_iterator j = {0};
+	while ((cmd = slash_list_iterate(&j)) != NULL) {
+		if (slash_help_group(cmd->name) == 0)
+			cmds[count++] = cmd;
+	}
+	if (count > 0 && slash_help_columns(help, cmds, count, 0, 0) < 0)
+		return -1;
+
+	/* Then each group with the rest of the names of its commands */
+	const char *group = NULL;
+	size_t group_len = 0;
+	count = 0;
+	slash_list_iterator k = {0};
+	do {
+		cmd = slash_list_iterate(&k);
+		size_t len = cmd ? slash_help_group(cmd->name) : 0;
+		if (len == 0 && cmd)
+			continue;
+		if (count > 0 && (!cmd || len != group_len || strncmp(cmd->name, group, len) != 0)) {
+			if (slash_help_append(help, "\n", 1) < 0 ||
+				slash_help_append(help, group, group_len) < 0 ||
+				slash_help_append(help, ":\n", 2) < 0 ||
+				slash_help_columns(help, cmds, count, group_len + 1, SLASH_HELP_INDENT) < 0)
+				return -1;
+			count = 0;
+		}
+		if (cmd) {
+			group = cmd->name;
+			group_len = len;
+			cmds[count++] = cmd;
+		}
+	} while (cmd);
+
+	return 0;
+}
+
+int slash_help_list(struct slash *slash)
+{
+	struct slash_help *help = slash->help;
+	if (!help) {
+		help = calloc(1, sizeof(*help));
+		if (!help)
+			return SLASH_ENOMEM;
+		slash->help = help;
+	}
+
+	unsigned int width = slash_help_width(slash);
+
+	slash_list_read_lock();
+	unsigned int generation = slash_list_generation();
+	if (!help->valid || help->generation != generation || help->width != width) {
+		help->valid = false;
+		help->width = width;
+		if (slash_help_render(slash, help) < 0) {
+			slash_list_read_unlock();
+			return SLASH_ENOMEM;
+		}
+		help->generation = generation;
+		help->valid = true;
+	}
+	slash_list_read_unlock();
+
+	/* After what the command printed before, in one write */
+	fflush(stdout);
+	if (slash_write(slash, help->buf, help->length) < 0)
+		return SLASH_EIO;
+
+	return SLASH_SUCCESS;
+}
+
+void slash_help_free(struct slash *slash)
+{
+	if (!slash->help)
+		return;
+
+	free(slash->help->buf);
+	free(slash->help);
+	slash->help = NULL;
+}
@@ -0,0 +1,187 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <slash/slash.h>
+
+#include "builtins.h"
+
+#define SLASH_UNIQUE_EMPTY	NULL
+
+/* Digest of an entry and where it is in the ring */
+struct slash_history_slot {
+	uint64_t digest;
+	char *entry;
+};
+
+/**
+ * Set of the history entries by digest, open addressing with linear probing. Each text is in
+ * the set once, with its most recent entry, so a line executed again is found and moved to the
+ * end of the ring instead of being stored twice.
+ */
+struct slash_history_unique {
+	struct slash_history_slot *slots;
+	unsigned int size;
+	unsigned int count;
+};
+
+/* FNV-1a of the line, or of the entry in the ring */
+static uint64_t slash_history_digest(struct slash *slash, char *s, bool ring)
+{
+	uint64_t digest = 0xcbf29ce484222325ull;
+
+	while (*s != '\0') {
+		digest ^= (unsigned char) *s;
+		digest *= 0x100000001b3ull;
+		s = ring ? slash_history_increment(slash, s) : s + 1;
+	}
+
+	return digest;
+}
+
+static struct slash_history_slot *slash_history_unique_slot(struct slash_history_unique *set, uint64_t digest)
+{
+	unsigned int mask = set->size - 1;
+	unsigned int i = digest & mask;
+
+	while (set->slots[i].entry != SLASH_UNIQUE_EMPTY && set->slots[i].digest != digest)
+		i = (i + 1) & mask;
+
+	return &set->slots[i];
+}
+
+static int slash_history_unique_grow(struct slash_history_unique *set)
+{
+	/* Keep the load factor below 1/2 */
+	if (set->slots && (set->count + 1) * 2 < set->size)
+		return 0;
+
+	struct slash_history_unique old = *set;
+	set->size = old.size ? old.size * 2 : 64;
+	set->slots = calloc(set->size, sizeof(*set->slots));
+	if (!set->slots) {
+		*set = old;
+		return -1;
+	}
+
+	for (unsigned int i = 0; i < old.size; i++) {
+		if (old.slots[i].entry != SLASH_UNIQUE_EMPTY)
+			*slash_history_unique_slot(set, old.slots[i].digest) = old.slots[i];
+	}
+	free(old.slots);
+
+	return 0;
+}
+
+/* Add an entry, which replaces an older one of the same text when replace is set */
+static void slash_history_unique_insert(struct slash *slash, char *entry, bool replace)
+{
+	struct slash_history_unique *set = slash->history_unique;
+	if (*entry == '\0' || slash_history_unique_grow(set) < 0)
+		return;
+
+	uint64_t digest = slash_history_digest(slash, entry, true);
+	struct slash_history_slot *slot = slash_history_unique_slot(set, digest);
+	if (slot->entry == SLASH_UNIQUE_EMPTY) {
+		slot->digest = digest;
+		slot->entry = entry;
+		set->count++;
+	} else if (replace && slash_history_equal(slash, slot->entry, entry, true)) {
+		slot->entry = entry;
+	}
+}
+
+void slash_history_unique_add(struct slash *slash, char *entry)
+{
+	if (slash->history_unique)
+		slash_history_unique_insert(slash, entry, false);
+}
+
+char *slash_history_unique_find(struct slash *slash, char *line)
+{
+	struct slash_history_unique *set = slash->history_unique;
+	if (!set || set->count == 0)
+		return NULL;
+
+	struct slash_history_slot *slot = slash_history_unique_slot(set, slash_history_digest(slash, line, false));
+	if (slot->entry == SLASH_UNIQUE_EMPTY || !slash_history_equal(slash, slot->entry, line, false))
+		return NULL;
+
+	return slot->entry;
+}
+
+void slash_history_unique_remove(struct slash *slash, char *entry)
+{
+	struct slash_history_unique *set = slash->history_unique;
+	if (!set || set->count == 0 || *entry == '\0')
+		return;
+
+	/* An older copy of the text is not in the set */
+	unsigned int mask = set->size - 1;
+	struct slash_history_slot *slot = slash_history_unique_slot(set, slash_history_digest(slash, entry, true));
+	if (slot->entry != entry)
+		return;
+
+	/* Move back the following slots which probed past this one */
+	unsigned int i = slot - set->slots;
+	unsigned int j = i;
+	for (;;) {
+		j = (j + 1) & mask;
+		if (set->slots[j].entry == SLASH_UNIQUE_EMPTY)
+			break;
+		unsigned int home = set->slots[j].digest & mask;
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			set->slots[i] = set->slots[j];
+			i = j;
+		}
+	}
+	set->slots[i].entry = SLASH_UNIQUE_EMPTY;
+	set->count--;
+}
+
+void slash_history_unique_moved(struct slash *slash, char *removed, size_t len)
+{
+	struct slash_history_unique *set = slash->history_unique;
+	if (!set)
+		return;
+
+	for (unsigned int i = 0; i < set->size; i++) {
+		if (set->slots[i].entry != SLASH_UNIQUE_EMPTY)
+			set->slots[i].entry = slash_history_moved(slash, set->slots[i].entry, removed, len);
+	}
+}
+
+int slash_set_history_unique(struct slash *slash, bool unique)
+{
+	if (!unique) {
+		slash_history_unique_free(slash);
+		return SLASH_SUCCESS;
+	}
+	if (slash->history_unique)
+		return SLASH_SUCCESS;
+
+	slash->history_unique = calloc(1, sizeof(*slash->history_unique));
+	if (!slash->history_unique)
+		return SLASH_ENOMEM;
+
+	/* The entries already in the history, the most recent of each text is kept */
+	char *p = slash->history_head;
+	while (p != slash->history_tail) {
+		slash_history_unique_insert(slash, p, true);
+		while (*p != '\0')
+			p = slash_history_increment(slash, p);
+		p = slash_history_increment(slash, p);
+	}
+
+	return SLASH_SUCCESS;
+}
+
+void slash_history_unique_free(struct slash *slash)
+{
+	if (!slash->history_unique)
+		return;
+
+	free(slash->history_unique->slots);
+	free(slash->history_unique);
+	slash->history_unique = NULL;
+}
@@ -8,6 +8,8 @@
 #include <slash/optparse.h>
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -34,6 +36,21 @@ struct optparse {
 	const char ** argv;
 	const char *help;
 	void * ptr;
+
+	/* Caller provided storage, see optparse_new_arena() */
+	bool in_arena;
+	char * arena_next;
+	char * arena_end;
+
+	/* Lookup index, rebuilt by the first parse after options were added:
+	   all options sorted by long option name (those without one last),
+	   and the position + 1 in that array of the option for each short option character */
+	unsigned count;
+	unsigned long_count;
+	bool index_valid;
+	optparse_opt_t ** index;
+	unsigned index_size;
+	uint16_t short_index[256];
 };
 
 struct optparse_opt {
@@ -49,24 +66,39 @@ struct optparse_opt {
 
 	optparse_func_t func;
 	void * data;
+	unsigned ordinal;
 
 	union {
 		unsigned num_base;
 		int set_value;
+		optparse_custom_func_t custom_func;
 	} spec;
-	bool should_free_data;
 };
 
-optparse_t *
-optparse_new(const char * progname, const char * arg_summary) {
-	return optparse_new_ex(progname, arg_summary, NULL);
-}
+#define OPTPARSE_ALIGN(size) (((size) + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1))
 
-optparse_t *optparse_new_ex(const char *progname, const char *arg_summary, const char *help) {
-	optparse_t * parser;
+_Static_assert(OPTPARSE_ALIGN(sizeof(struct optparse)) <= OPTPARSE_PARSER_SIZE, "OPTPARSE_PARSER_SIZE too small");
+_Static_assert(OPTPARSE_ALIGN(sizeof(struct optparse_opt)) <= OPTPARSE_OPT_SIZE, "OPTPARSE_OPT_SIZE too small");
 
-	parser = malloc(sizeof(*parser));
-	memset(parser, 0, sizeof(*parser));
+static void * optparse_alloc(optparse_t * parser, size_t size) {
+
+	if (!parser->in_arena)
+		return calloc(1, size);
+
+	size = OPTPARSE_ALIGN(size);
+	if ((size_t) (parser->arena_end - parser->arena_next) < size) {
+		fprintf(stderr, "%s: too many options for the parser storage\n", parser->progname);
+		return NULL;
+	}
+
+	void * ptr = parser->arena_next;
+	parser->arena_next += size;
+	memset(ptr, 0, size);
+
+	return ptr;
+}
+
+static void optparse_init(optparse_t * parser, const char * progname, const char * arg_summary, const char * help) {
 
 	parser->last_option = &parser->options;
 
@@ -78,51 +110,185 @@ optparse_t *optparse_new_ex(const char *progname, const char *arg_summary, const
 		parser->arg_summary = arg_summary;
 
 	parser->help = help;
+}
+
+optparse_t *
+optparse_new(const char * progname, const char * arg_summary) {
+	return optparse_new_ex(progname, arg_summary, NULL);
+}
+
+optparse_t *optparse_new_ex(const char *progname, const char *arg_summary, const char *help) {
+	optparse_t * parser;
+
+	parser = calloc(1, sizeof(*parser));
+	if (!parser)
+		return NULL;
+
+	optparse_init(parser, progname, arg_summary, help);
+
+	return parser;
+}
+
+optparse_t *optparse_new_arena(void *buf, size_t size, const char *progname, const char *arg_summary, const char *help) {
+	optparse_t * parser;
+
+	/* Align the start of the storage */
+	uintptr_t start = OPTPARSE_ALIGN((uintptr_t) buf);
+	if (buf == NULL || start - (uintptr_t) buf + OPTPARSE_ALIGN(sizeof(*parser)) > size)
+		return NULL;
+
+	parser = (optparse_t *) start;
+	memset(parser, 0, sizeof(*parser));
+	optparse_init(parser, progname, arg_summary, help);
+
+	parser->in_arena = true;
+	parser->arena_next = (char *) parser + OPTPARSE_ALIGN(sizeof(*parser));
+	parser->arena_end = (char *) buf + size;
 
 	return parser;
 }
 
+void optparse_reset(optparse_t * parser) {
+	parser->current_option = NULL;
+	parser->argi = 0;
+	parser->argc = 0;
+	parser->argv = NULL;
+}
+
 void optparse_del(optparse_t * parser) {
 	optparse_opt_t * opt;
 
+	/* Options in caller provided storage are released with the storage */
+	if (!parser || parser->in_arena)
+		return;
+
 	while ((opt = parser->options)) {
 		parser->options = opt->next;
-		if(opt->should_free_data) {
-			free(opt->data);
-		}
 		free(opt);
 	}
+	free(parser->index);
 	free(parser);
 }
 
+static bool optparse_build_index(optparse_t * parser) {
+
+	if (parser->index_size < parser->count) {
+		optparse_opt_t ** index;
+		if (parser->in_arena) {
+			index = optparse_alloc(parser, parser->count * sizeof(*index));
+		} else {
+			index = realloc(parser->index, parser->count * sizeof(*index));
+		}
+		if (!index)
+			return false;
+		parser->index = index;
+		parser->index_size = parser->count;
+	}
+
+	/* Insertion sort keeps options with the same name in the order they were added,
+	   so the first one wins, like it always did */
+	unsigned n = 0;
+	parser->long_count = 0;
+	for (optparse_opt_t * opt = parser->options; opt; opt = opt->next) {
+		if (!opt->long_opt)
+			continue;
+		unsigned i = n++;
+		while (i > 0 && strcmp(parser->index[i - 1]->long_opt, opt->long_opt) > 0) {
+			parser->index[i] = parser->index[i - 1];
+			i--;
+		}
+		parser->index[i] = opt;
+	}
+	parser->long_count = n;
+	for (optparse_opt_t * opt = parser->options; opt; opt = opt->next) {
+		if (!opt->long_opt)
+			parser->index[n++] = opt;
+	}
+
+	memset(parser->short_index, 0, sizeof(parser->short_index));
+	for (unsigned i = 0; i < n; i++) {
+		int c = parser->index[i]->short_opt;
+		if (c <= 0 || c > UCHAR_MAX)
+			continue;
+		/* First added option wins */
+		if (parser->short_index[c] == 0 || parser->index[parser->short_index[c] - 1]->ordinal > parser->index[i]->ordinal)
+			parser->short_index[c] = i + 1;
+	}
+
+	parser->index_valid = true;
+	return true;
+}
+
+/* Find a long option by its name or an unambiguous abbreviation of it */
+static optparse_opt_t * find_long_opt(optparse_t * parser, const char * s, size_t len, bool * ambiguous) {
+
+	*ambiguous = false;
+	if (len == 0)
+		return NULL;
+
+	/* First name which is not smaller than s */
+	unsigned lo = 0, hi = parser->long_count;
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+		if (strncmp(parser->index[mid]->long_opt, s, len) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == parser->long_count || strncmp(parser->index[lo]->long_opt, s, len) != 0)
+		return NULL;
+
+	/* Exact match */
+	optparse_opt_t * opt = parser->index[lo];
+	if (opt->long_opt_len == len)
+		return opt;
+
+	/* Abbreviation, must only match a single option */
+	if (lo + 1 < parser->long_count && strncmp(parser->index[lo + 1]->long_opt, s, len) == 0) {
+		*ambiguous = true;
+		return NULL;
+	}
+
+	return opt;
+}
+
 static int
 handle_long_opt(optparse_t * parser, const char * s) {
 	optparse_opt_t * opt;
+	bool ambiguous;
+
+	const char * value = strchr(s, '=');
+	size_t len = value ? (size_t) (value - s) : strlen(s);
+
+	opt = find_long_opt(parser, s, len, &ambiguous);
+	if (opt) {
+		if (!value) {
+			if (opt->arg_desc && !(opt->flags & OPTPARSE_FLAG_OPTIONAL)) {
+				fprintf(stderr, "%s: \"--%s\" requires an argument\n",
+						parser->progname, s);
+				return 0;
+			}
 
-	for (opt = parser->options; opt; opt = opt->next) {
-		if (!strncmp(s, opt->long_opt, opt->long_opt_len)) {
-			if (!s[opt->long_opt_len]) {
-				if (opt->arg_desc && !(opt->flags & OPTPARSE_FLAG_OPTIONAL)) {
-					fprintf(stderr, "%s: \"--%s\" requires an argument\n",
-							parser->progname, s);
-					return 0;
-				}
-
-				return opt->func(opt, NULL);
-			} else if (s[opt->long_opt_len] == '=') {
-				if (!opt->arg_desc) {
-					fprintf(stderr, "%s: \"--%s\" does not take an argument\n",
-							parser->progname, s);
-					return 0;
-				}
-
-				return opt->func(opt, s + opt->long_opt_len + 1);
+			return opt->func(opt, NULL);
+		} else {
+			if (!opt->arg_desc) {
+				fprintf(stderr, "%s: \"--%s\" does not take an argument\n",
+						parser->progname, s);
+				return 0;
 			}
+
+			return opt->func(opt, value + 1);
 		}
 	}
 
-	fprintf(stderr, "%s: invalid option \"--%s\"\n",
-			parser->progname, s);
+	if (ambiguous) {
+		fprintf(stderr, "%s: option \"--%.*s\" is ambiguous\n",
+				parser->progname, (int) len, s);
+	} else {
+		fprintf(stderr, "%s: invalid option \"--%s\"\n",
+				parser->progname, s);
+	}
 	fprintf(stderr, "Try \"%s --help\" for more information.\n",
 			parser->progname);
 
@@ -133,25 +299,25 @@ static int
 handle_short_opt(optparse_t * parser, char c, char c2) {
 	optparse_opt_t * opt;
 
-	for (opt = parser->options; opt; opt = opt->next) {
-		if (opt->short_opt && c == opt->short_opt) {
-			if (opt->arg_desc) {
-				if (parser->argi > parser->argc) {
+	unsigned pos = parser->short_index[(unsigned char) c];
+	if (pos) {
+		opt = parser->index[pos - 1];
+		if (opt->arg_desc) {
+			if (parser->argi > parser->argc) {
+				fprintf(stderr, "%s: \"-%c\" requires an argument\n", parser->progname, c);
+				return 0;
+			}
+			if (c2 == '\0') {
+				if (parser->argi >= parser->argc) {
 					fprintf(stderr, "%s: \"-%c\" requires an argument\n", parser->progname, c);
 					return 0;
 				}
-				if (c2 == '\0') {
-					if (parser->argi >= parser->argc) {
-						fprintf(stderr, "%s: \"-%c\" requires an argument\n", parser->progname, c);
-						return 0;
-					}
-					return opt->func(opt, parser->argv[parser->argi++]);
-				} else {
-					return opt->func(opt, parser->argv[parser->argi - 1] + 2);
-				}
+				return opt->func(opt, parser->argv[parser->argi++]);
 			} else {
-				return opt->func(opt, NULL);
+				return opt->func(opt, parser->argv[parser->argi - 1] + 2);
 			}
+		} else {
+			return opt->func(opt, NULL);
 		}
 	}
 
@@ -164,6 +330,9 @@ handle_short_opt(optparse_t * parser, char c, char c2) {
 }
 
 int optparse_parse(optparse_t * parser, int argc, const char * argv[]) {
+	if (!parser->index_valid && !optparse_build_index(parser))
+		return -1;
+
 	parser->argc = argc;
 	parser->argv = argv;
 
@@ -201,8 +370,9 @@ optparse_opt_new(optparse_t * parser,
 				 optparse_func_t func, void * data) {
 	optparse_opt_t * opt;
 
-	opt = malloc(sizeof(*opt));
-	memset(opt, 0, sizeof(*opt));
+	opt = optparse_alloc(parser, sizeof(*opt));
+	if (!opt)
+		return NULL;
 
 	opt->parser = parser;
 	opt->short_opt = short_opt;
@@ -213,56 +383,35 @@ optparse_opt_new(optparse_t * parser,
 	opt->help = help;
 	opt->func = func;
 	opt->data = data;
-	opt->should_free_data = false;
+	opt->ordinal = parser->count++;
 
 	*parser->last_option = opt;
 	parser->last_option = &opt->next;
+	parser->index_valid = false;
 
 	return opt;
 }
 
-struct custom_opt_ctx {
-	optparse_custom_func_t func;
-	void *org_data;
-};
-
 static int optparse_custom_func_trampoline(optparse_opt_t * opt, const char * arg) {
-	struct custom_opt_ctx * custom_ctx = opt->data;
-	return custom_ctx->func(custom_ctx->org_data, arg);
+	return opt->spec.custom_func(opt->data, arg);
 }
 
 optparse_opt_t *optparse_add_custom(optparse_t * parser, int short_opt, const char * long_opt, const char * arg_desc, const char * help, optparse_custom_func_t func, void * data) {
-	optparse_opt_t * opt = NULL;
-	struct custom_opt_ctx *custom_ctx = calloc(1, sizeof(*custom_ctx));
-	if (custom_ctx) {
-		custom_ctx->func = func;
-		custom_ctx->org_data = data;
-		opt = malloc(sizeof(*opt));
-		if(opt) {
-			memset(opt, 0, sizeof(*opt));
-
-			opt->parser = parser;
-			opt->short_opt = short_opt;
-			opt->long_opt = long_opt;
-			if (opt->long_opt)
-				opt->long_opt_len = strlen(opt->long_opt);
-			opt->arg_desc = arg_desc;
-			opt->help = help;
-			opt->func = optparse_custom_func_trampoline;
-			opt->data = custom_ctx;
-			opt->should_free_data = true;
-			*parser->last_option = opt;
-			parser->last_option = &opt->next;
-		} else {
-			free(custom_ctx);
-		}
-	}
+	optparse_opt_t * opt;
+
+	opt = optparse_opt_new(parser,
+						   short_opt, long_opt, arg_desc, help,
+						   optparse_custom_func_trampoline, data);
+	if (opt)
+		opt->spec.custom_func = func;
+
 	return opt;
 }
 
 optparse_opt_t *
 optparse_arg_optional(optparse_opt_t * opt) {
-	opt->flags |= OPTPARSE_FLAG_OPTIONAL;
+	if (opt)
+		opt->flags |= OPTPARSE_FLAG_OPTIONAL;
 
 	return opt;
 }
@@ -347,8 +496,8 @@ optparse_add_set(optparse_t * parser,
 	opt = optparse_opt_new(parser,
 						   short_opt, long_opt, NULL, help,
 						   optparse_handle_set, ptr);
-
-	opt->spec.set_value = value;
+	if (opt)
+		opt->spec.set_value = value;
 
 	return opt;
 }
@@ -385,7 +534,8 @@ optparse_add_int(optparse_t * parser,
 						   short_opt, long_opt, arg_desc, help,
 						   optparse_handle_int, ptr);
 
-	opt->spec.num_base = base;
+	if (opt)
+		opt->spec.num_base = base;
 
 	return opt;
 }
@@ -422,7 +572,8 @@ optparse_add_unsigned(optparse_t * parser,
 						   short_opt, long_opt, arg_desc, help,
 						   optparse_handle_unsigned, ptr);
 
-	opt->spec.num_base = base;
+	if (opt)
+		opt->spec.num_base = base;
 
 	return opt;
 }
@@ -0,0 +1,188 @@
+#include <slash/slash.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+/* Table driven option parser for the option schemas of commands, see struct slash_opt */
+
+static const struct slash_opt * slash_opts_find_short(const struct slash_opt * opts, char c) {
+
+	for (const struct slash_opt * opt = opts; opt->short_opt || opt->long_opt; opt++) {
+		if (opt->short_opt == c)
+			return opt;
+	}
+
+	return NULL;
+}
+
+/* Find a long option by its name or an unambiguous abbreviation of it */
+static const struct slash_opt * slash_opts_find_long(const struct slash_opt * opts, const char * name, size_t len, bool * ambiguous) {
+
+	const struct slash_opt * found = NULL;
+
+	*ambiguous = false;
+	if (len == 0)
+		return NULL;
+
+	for (const struct slash_opt * opt = opts; opt->short_opt || opt->long_opt; opt++) {
+		if (!opt->long_opt || strncmp(opt->long_opt, name, len) != 0)
+			continue;
+		/* An exact match wins over abbreviations */
+		if (opt->long_opt[len] == '\0')
+			return opt;
+		if (found)
+			*ambiguous = true;
+		found = opt;
+	}
+
+	return *ambiguous ? NULL : found;
+}
+
+static int slash_opts_store(struct slash * slash, const struct slash_opt * opt, const char * arg, void * values) {
+
+	char * dest = (char *) values + opt->offset;
+	char * end;
+
+	switch (opt->type) {
+	case SLASH_OPT_TYPE_FLAG:
+		memcpy(dest, &opt->value, sizeof(int));
+		return 0;
+	case SLASH_OPT_TYPE_INT: {
+		long l = strtol(arg, &end, 0);
+		if (*arg == '\0' || *end || l < INT_MIN || l > INT_MAX)
+			break;
+		int value = l;
+		memcpy(dest, &value, sizeof(value));
+		return 0;
+	}
+	case SLASH_OPT_TYPE_UNSIGNED: {
+		unsigned long l = strtoul(arg, &end, 0);
+		if (*arg == '\0' || *arg == '-' || *end || l > UINT_MAX)
+			break;
+		unsigned int value = l;
+		memcpy(dest, &value, sizeof(value));
+		return 0;
+	}
+	case SLASH_OPT_TYPE_DOUBLE: {
+		double value = strtod(arg, &end);
+		if (*arg == '\0' || *end)
+			break;
+		memcpy(dest, &value, sizeof(value));
+		return 0;
+	}
+	case SLASH_OPT_TYPE_STRING:
+		memcpy(dest, &arg, sizeof(arg));
+		return 0;
+	}
+
+	slash_printf(slash, "Invalid number \"%s\"\n", arg);
+	return -1;
+}
+
+static int slash_opts_parse_long(struct slash * slash, const struct slash_opt * opts, const char * s, void * values) {
+
+	const char * value = strchr(s, '=');
+	size_t len = value ? (size_t) (value - s) : strlen(s);
+	bool ambiguous;
+
+	const struct slash_opt * opt = slash_opts_find_long(opts, s, len, &ambiguous);
+	if (!opt) {
+		if (ambiguous)
+			slash_printf(slash, "Option \"--%.*s\" is ambiguous\n", (int) len, s);
+		else if (len != 4 || strncmp(s, "help", 4) != 0)
+			slash_printf(slash, "Invalid option \"--%s\"\n", s);
+		return -1;
+	}
+
+	if (opt->arg_desc && !value) {
+		slash_printf(slash, "\"--%s\" requires an argument\n", s);
+		return -1;
+	}
+	if (!opt->arg_desc && value) {
+		slash_printf(slash, "\"--%s\" does not take an argument\n", s);
+		return -1;
+	}
+
+	return slash_opts_store(slash, opt, value ? value + 1 : NULL, values);
+}
+
+int slash_opts_parse(struct slash *slash, const struct slash_opt *opts, void *values) {
+
+	int argi = 1;
+	while (argi < slash->argc) {
+		const char * s = slash->argv[argi];
+
+		if (s[0] != '-' || s[1] == '\0')
+			break;
+		argi++;
+
+		if (s[1] == '-') {
+			/* "--" ends the options */
+			if (s[2] == '\0')
+				break;
+			if (slash_opts_parse_long(slash, opts, s + 2, values) < 0)
+				return -1;
+			continue;
+		}
+
+		/* Short options, flags can be combined */
+		for (const char * c = s + 1; *c; c++) {
+			const struct slash_opt * opt = slash_opts_find_short(opts, *c);
+			if (!opt) {
+				if (*c != 'h')
+					slash_printf(slash, "Invalid option \"-%c\"\n", *c);
+				return -1;
+			}
+
+			if (!opt->arg_desc) {
+				if (slash_opts_store(slash, opt, NULL, values) < 0)
+					return -1;
+				continue;
+			}
+
+			/* The argument is the rest of this one or the next argument */
+			const char * arg = c[1] ? c + 1 : slash->argv[argi++];
+			if (argi > slash->argc) {
+				slash_printf(slash, "\"-%c\" requires an argument\n", *c);
+				return -1;
+			}
+			if (slash_opts_store(slash, opt, arg, values) < 0)
+				return -1;
+			break;
+		}
+	}
+
+	return argi;
+}
+
+void slash_opts_help(struct slash *slash, const struct slash_opt *opts) {
+
+	slash_printf(slash, "Options:\n");
+	for (const struct slash_opt * opt = opts; opt->short_opt || opt->long_opt; opt++) {
+		int col = slash_printf(slash, "  ");
+		if (opt->short_opt) {
+			col += slash_printf(slash, "-%c", opt->short_opt);
+			if (opt->long_opt)
+				col += slash_printf(slash, ", ");
+			else if (opt->arg_desc)
+				col += slash_printf(slash, " %s", opt->arg_desc);
+		} else {
+			col += slash_printf(slash, "    ");
+		}
+		if (opt->long_opt) {
+			col += slash_printf(slash, "--%s", opt->long_opt);
+			if (opt->arg_desc)
+				col += slash_printf(slash, "=%s", opt->arg_desc);
+		}
+
+		if (opt->help) {
+			if (col >= 28) {
+				slash_printf(slash, "\n");
+				col = 0;
+			}
+			slash_printf(slash, "%*s%s", 28 - col, "", opt->help);
+		}
+		slash_printf(slash, "\n");
+	}
+}
@@ -0,0 +1,283 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <slash/slash.h>
+#include <slash/completer.h>
+
+#include "builtins.h"
+
+/**
+ * Jobs are child processes, not threads: commands print to the process wide stdout, which only a
+ * process of its own can redirect to the pipe of its job. The child of a multithreaded application
+ * only has the thread which called fork(), so a job must not use the threads of the application,
+ * nor anything a thread of the application may have held locked at the fork (a mutex of a driver,
+ * a connection being written), and must not add or remove commands.
+ */
+
+/* Output of a job is printed by whole lines, so jobs do not mix within a line */
+#define SLASH_PRUN_LINE_SIZE	256
+
+struct slash_prun_job {
+	const char *value;
+	char label[32];
+	pid_t pid;
+	int fd;
+	int ret;
+	size_t length;
+	char *line;
+};
+
+struct slash_prun_opts {
+	unsigned int jobs;
+	unsigned int count;
+	const char *name;
+};
+
+static const struct slash_opt slash_prun_opts[] = {
+	SLASH_OPT_UNSIGNED('j', "jobs", "NUM", struct slash_prun_opts, jobs, "jobs running at the same time (default = number of cores)"),
+	SLASH_OPT_UNSIGNED('n', "count", "NUM", struct slash_prun_opts, count, "run the script NUM times, when no values are given"),
+	SLASH_OPT_STRING('v', "var", "NAME", struct slash_prun_opts, name, "variable holding the value of the job (default = job)"),
+	SLASH_OPT_END,
+};
+
+/* Runs in the child process of a job, with its output going to fd */
+static void slash_prun_child(struct slash *slash, const struct slash_script *script, const char *name,
+							 const char *value, int fd)
+{
+	int null_fd = open("/dev/null", O_RDONLY);
+	if (null_fd < 0 || dup2(fd, STDOUT_FILENO) < 0 || dup2(fd, STDERR_FILENO) < 0)
+		_exit(UINT8_MAX);
+	close(fd);
+
+	/* The job has a copy of the instance and its variables, with no terminal */
+	slash->fd_read = null_fd;
+	slash->waitfunc = NULL;
+	slash_var_set(slash, name, value);
+
+	int ret = slash_script_exec(slash, script, false);
+	fflush(stdout);
+
+	/* The result travels in the exit status, see slash_prun_status() */
+	_exit(ret & UINT8_MAX);
+}
+
+static int slash_prun_status(int status)
+{
+	if (!WIFEXITED(status))
+		return SLASH_EIO;
+	return (int8_t) WEXITSTATUS(status);
+}
+
+static void slash_prun_flush(struct slash *slash, struct slash_prun_job *job, int width)
+{
+	job->line[job->length] = '\0';
+	slash_printf(slash, "[%-*s] %s\n", width, job->label, job->line);
+	job->length = 0;
+}
+
+/* Read the output of a job, returns false at the end of it */
+static bool slash_prun_read(struct slash *slash, struct slash_prun_job *job, int width)
+{
+	char buf[512];
+	ssize_t n = read(job->fd, buf, sizeof(buf));
+	if (n < 0 && errno == EINTR)
+		return true;
+	if (n <= 0) {
+		if (job->length > 0)
+			slash_prun_flush(slash, job, width);
+		return false;
+	}
+
+	for (ssize_t i = 0; i < n; i++) {
+		if (buf[i] == '\n') {
+			slash_prun_flush(slash, job, width);
+		} else {
+			job->line[job->length++] = buf[i];
+			if (job->length == SLASH_PRUN_LINE_SIZE - 1)
+				slash_prun_flush(slash, job, width);
+		}
+	}
+
+	return true;
+}
+
+static int slash_prun_start(struct slash *slash, const struct slash_script *script, const char *name,
+							struct slash_prun_job *jobs, unsigned int index)
+{
+	struct slash_prun_job *job = &jobs[index];
+
+	int fds[2];
+	if (pipe(fds) < 0)
+		return -1;
+
+	fflush(stdout);
+	job->pid = fork();
+	if (job->pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+
+	if (job->pid == 0) {
+		/* Only the pipe of this job stays open in the child */
+		for (unsigned int i = 0; i < index; i++) {
+			if (jobs[i].fd >= 0)
+				close(jobs[i].fd);
+		}
+		close(fds[0]);
+		slash_prun_child(slash, script, name, job->value, fds[1]);
+	}
+
+	close(fds[1]);
+	job->fd = fds[0];
+
+	return 0;
+}
+
+static int slash_builtin_prun(struct slash *slash)
+{
+	slash_timeout_nested(slash);
+
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	struct slash_prun_opts opts = {
+		.jobs = cores > 0 ? cores : 1,
+		.count = 0,
+		.name = "job",
+	};
+
+	int argi = slash_opts_parse(slash, slash_prun_opts, &opts);
+	if (argi < 0 || argi >= slash->argc)
+		return SLASH_EUSAGE;
+
+	/* One job per value, or count jobs numbered from 1 */
+	const char *filename = slash->argv[argi++];
+	unsigned int total = slash->argc > argi ? (unsigned int) (slash->argc - argi) : opts.count;
+	if (total == 0 || opts.jobs == 0)
+		return SLASH_EUSAGE;
+
+	struct slash_prun_job *jobs = slash_alloc(slash, total * sizeof(*jobs));
+	struct pollfd *fds = slash_alloc(slash, total * sizeof(*fds));
+	if (!jobs || !fds)
+		return SLASH_ENOMEM;
+
+	int width = 0;
+	for (unsigned int i = 0; i < total; i++) {
+		struct slash_prun_job *job = &jobs[i];
+		if (slash->argc > argi) {
+			job->value = slash->argv[argi + i];
+			snprintf(job->label, sizeof(job->label), "%s", job->value);
+		} else {
+			snprintf(job->label, sizeof(job->label), "%u", i + 1);
+			job->value = job->label;
+		}
+		width = slash_max(width, (int) strlen(job->label));
+		job->pid = -1;
+		job->fd = -1;
+		job->ret = SLASH_SUCCESS;
+		job->length = 0;
+		job->line = slash_alloc(slash, SLASH_PRUN_LINE_SIZE);
+		if (!job->line)
+			return SLASH_ENOMEM;
+	}
+
+	/* The script is compiled once, the jobs inherit it */
+	char path[256];
+	struct slash_script *script;
+	int res = slash_script_load(slash, filename, path, sizeof(path), &script);
+	if (res != SLASH_SUCCESS)
+		return res;
+
+	void *ctx_for_post = NULL;
+	slash_on_run_pre_hook(path, &ctx_for_post);
+
+	struct timespec start, stop;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	unsigned int started = 0, running = 0, done = 0, failed = 0;
+	bool aborted = false;
+	while (running > 0 || (!aborted && started < total)) {
+		while (!aborted && running < opts.jobs && started < total) {
+			if (slash_prun_start(slash, script, opts.name, jobs, started) < 0) {
+				slash_printf(slash, "[%-*s] failed to start: %s\n", width, jobs[started].label, strerror(errno));
+				jobs[started].ret = SLASH_EIO;
+				done++;
+				failed++;
+			} else {
+				running++;
+			}
+			started++;
+		}
+
+		/* Wait for output from any running job */
+		nfds_t count = 0;
+		for (unsigned int i = 0; i < started; i++) {
+			if (jobs[i].fd >= 0) {
+				fds[count].fd = jobs[i].fd;
+				fds[count].events = POLLIN;
+				count++;
+			}
+		}
+		if (count == 0)
+			continue;
+
+		/* Stop the jobs on Ctrl-C or at the deadline, their output is still collected */
+		if (!aborted && slash_should_abort(slash)) {
+			aborted = true;
+			for (unsigned int i = 0; i < started; i++) {
+				if (jobs[i].fd >= 0)
+					kill(jobs[i].pid, SIGTERM);
+			}
+		}
+		if (poll(fds, count, aborted ? -1 : slash_remaining_ms(slash)) <= 0)
+			continue;
+
+		nfds_t f = 0;
+		for (unsigned int i = 0; i < started; i++) {
+			struct slash_prun_job *job = &jobs[i];
+			if (job->fd < 0 || fds[f++].revents == 0)
+				continue;
+			if (slash_prun_read(slash, job, width))
+				continue;
+
+			int status;
+			close(job->fd);
+			job->fd = -1;
+			waitpid(job->pid, &status, 0);
+			job->ret = slash_prun_status(status);
+			running--;
+			done++;
+			if (job->ret != SLASH_SUCCESS) {
+				failed++;
+				slash_printf(slash, "[%-*s] failed with %d\n", width, job->label, job->ret);
+			}
+			slash_printf(slash, "prun: %u/%u done, %u failed\n", done, total, failed);
+		}
+	}
+
+	/* Jobs never started count as failed */
+	failed += total - started;
+
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	slash_printf(slash, "prun: %u jobs in %.3f s\n", total,
+				 (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9);
+
+	slash_script_free(script);
+	slash_on_run_post_hook(path, ctx_for_post);
+
+	return failed ? SLASH_EIO : SLASH_SUCCESS;
+}
+slash_command_opts(prun, slash_builtin_prun, slash_path_completer, "<file> [values...]",
+				   "Run a script in parallel jobs, one per value with the value in $job,\n"
+				   "or -n times with the job number in $job. The output of the jobs is\n"
+				   "printed line by line, prefixed with the value or number of the job.\n"
+				   "Jobs are forked processes, without the threads of the application.",
+				   slash_prun_opts)
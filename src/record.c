@@ -0,0 +1,305 @@
+#include <slash/record.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "builtins.h"
+
+struct slash_recorder {
+	FILE *fp;
+	uint64_t start_ns;
+};
+
+/* Latency of the commands of a replay */
+struct slash_replay_stat {
+	char name[48];
+	unsigned int count;
+	uint64_t total_ns;
+	uint64_t max_ns;
+};
+
+static uint64_t slash_record_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int slash_record_start(struct slash *slash, const char *path) {
+
+	if (slash->record)
+		return -1;
+
+	struct slash_recorder *record = calloc(1, sizeof(*record));
+	if (!record)
+		return -1;
+
+	record->fp = fopen(path, "wb");
+	if (!record->fp) {
+		free(record);
+		return -1;
+	}
+
+	struct slash_record_header header = {
+		.magic = SLASH_RECORD_MAGIC,
+		.version = SLASH_RECORD_VERSION,
+	};
+	fwrite(&header, sizeof(header), 1, record->fp);
+
+	record->start_ns = slash_record_now();
+	slash->record = record;
+
+	return 0;
+}
+
+void slash_record_stop(struct slash *slash) {
+
+	if (!slash->record)
+		return;
+
+	fclose(slash->record->fp);
+	free(slash->record);
+	slash->record = NULL;
+}
+
+static void slash_record_event(struct slash *slash, enum slash_record_type type, const char *data, size_t len) {
+
+	struct slash_record_event event = {
+		.time_ns = slash_record_now() - slash->record->start_ns,
+		.type = type,
+		.len = len,
+	};
+	fwrite(&event, sizeof(event), 1, slash->record->fp);
+	fwrite(data, 1, len, slash->record->fp);
+}
+
+void slash_record_keys(struct slash *slash, const char *keys, size_t len) {
+	slash_record_event(slash, SLASH_RECORD_KEYS, keys, len);
+}
+
+void slash_record_line(struct slash *slash, const char *line) {
+	slash_record_event(slash, SLASH_RECORD_LINE, line, strlen(line));
+	/* Keep the recording of a crashed session */
+	fflush(slash->record->fp);
+}
+
+/* Iterate the events of a recording loaded in memory, returns the data of the event */
+static const char *slash_record_next(const char *data, size_t size, size_t *pos, struct slash_record_event *event) {
+
+	if (*pos + sizeof(*event) > size)
+		return NULL;
+
+	/* Events are not aligned in the file */
+	memcpy(event, data + *pos, sizeof(*event));
+	if (*pos + sizeof(*event) + event->len > size)
+		return NULL;
+
+	const char *payload = data + *pos + sizeof(*event);
+	*pos += sizeof(*event) + event->len;
+	return payload;
+}
+
+static int slash_replay_write(int fd, const char *buf, size_t len) {
+
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/* Runs in a child process, writing the input of the replay at the recorded times */
+static void slash_replay_feed(int fd, const char *data, size_t size, bool keys, unsigned int speed) {
+
+	uint64_t start_ns = slash_record_now();
+	size_t pos = sizeof(struct slash_record_header);
+	struct slash_record_event event;
+	const char *payload;
+
+	while ((payload = slash_record_next(data, size, &pos, &event)) != NULL) {
+		if (event.type != (keys ? SLASH_RECORD_KEYS : SLASH_RECORD_LINE))
+			continue;
+
+		if (speed > 0) {
+			uint64_t due_ns = start_ns + event.time_ns / speed;
+			uint64_t now_ns = slash_record_now();
+			if (due_ns > now_ns) {
+				struct timespec ts = {
+					.tv_sec = (due_ns - now_ns) / 1000000000ull,
+					.tv_nsec = (due_ns - now_ns) % 1000000000ull,
+				};
+				nanosleep(&ts, NULL);
+			}
+		}
+
+		if (slash_replay_write(fd, payload, event.len) < 0)
+			return;
+		if (!keys && slash_replay_write(fd, "\n", 1) < 0)
+			return;
+	}
+}
+
+static void slash_replay_measure(struct slash_replay_stat *stats, size_t *count, size_t max,
+								 const char *name, uint64_t ns) {
+
+	size_t i;
+	for (i = 0; i < *count; i++) {
+		if (strcmp(stats[i].name, name) == 0)
+			break;
+	}
+
+	if (i == *count) {
+		if (*count == max)
+			return;
+		snprintf(stats[i].name, sizeof(stats[i].name), "%s", name);
+		(*count)++;
+	}
+
+	stats[i].count++;
+	stats[i].total_ns += ns;
+	if (ns > stats[i].max_ns)
+		stats[i].max_ns = ns;
+}
+
+/* Load a recording into memory and check its header */
+static char *slash_replay_load(const char *path, size_t *size) {
+
+	FILE *fp = fopen(path, "rb");
+	if (!fp)
+		return NULL;
+
+	char *data = NULL;
+	if (fseek(fp, 0, SEEK_END) == 0) {
+		long end = ftell(fp);
+		rewind(fp);
+		if (end >= (long) sizeof(struct slash_record_header) && (data = malloc(end)) != NULL) {
+			*size = fread(data, 1, end, fp);
+		}
+	}
+	fclose(fp);
+
+	if (data) {
+		struct slash_record_header header;
+		memcpy(&header, data, sizeof(header));
+		if (*size < sizeof(header) || header.magic != SLASH_RECORD_MAGIC || header.version != SLASH_RECORD_VERSION) {
+			free(data);
+			return NULL;
+		}
+	}
+
+	return data;
+}
+
+int slash_replay(struct slash *slash, const char *path, unsigned int speed) {
+
+	size_t size = 0;
+	char *data = slash_replay_load(path, &size);
+	if (!data) {
+		slash_printf(slash, "Failed to load recording %s\n", path);
+		return -1;
+	}
+
+	/* Replay the keystrokes if there are any, otherwise the executed lines */
+	bool keys = false;
+	size_t pos = sizeof(struct slash_record_header);
+	struct slash_record_event event;
+	while (slash_record_next(data, size, &pos, &event) != NULL)
+		keys |= event.type == SLASH_RECORD_KEYS;
+
+	/* The replay instance reads the input from a pipe, and its echo goes nowhere */
+	char hist[1024];
+	char *line_buf = calloc(1, slash->line_size);
+	int fds[2] = {-1, -1};
+	int null_fd = open("/dev/null", O_WRONLY);
+	if (!line_buf || null_fd < 0 || pipe(fds) < 0) {
+		slash_printf(slash, "Failed to set up the replay\n");
+		goto err;
+	}
+
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid < 0) {
+		slash_printf(slash, "Failed to start the replay\n");
+		goto err;
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		slash_replay_feed(fds[1], data, size, keys, speed);
+		_exit(0);
+	}
+	close(fds[1]);
+	fds[1] = -1;
+
+	struct slash replay = {0};
+	slash_create_static(&replay, line_buf, slash->line_size, hist, sizeof(hist));
+	replay.fd_read = fds[0];
+	replay.fd_write = null_fd;
+	replay.waitfunc = NULL;
+
+	struct slash_replay_stat stats[64] = {0};
+	size_t stat_count = 0;
+	int commands = 0;
+	uint64_t start_ns = slash_record_now();
+
+	char *line;
+	while ((line = slash_readline(&replay)) != NULL) {
+		if (strspn(line, " \t\r\n") == strlen(line))
+			continue;
+
+		char name[sizeof(stats[0].name)] = "(unknown)";
+		char *args;
+		slash_list_read_lock();
+		struct slash_command *command = slash_command_find(&replay, line, strlen(line), &args);
+		if (command)
+			snprintf(name, sizeof(name), "%s", command->name);
+		slash_list_read_unlock();
+
+		uint64_t before_ns = slash_record_now();
+		int ret = slash_execute(&replay, line);
+		slash_replay_measure(stats, &stat_count, sizeof(stats) / sizeof(stats[0]), name, slash_record_now() - before_ns);
+		commands++;
+
+		if (ret == SLASH_EXIT)
+			break;
+	}
+
+	double elapsed = (slash_record_now() - start_ns) / 1e9;
+	slash_destroy_static(&replay);
+	close(fds[0]);
+	waitpid(pid, NULL, 0);
+
+	slash_printf(slash, "Replayed %d commands in %.3f s, %.1f commands/s\n",
+				 commands, elapsed, elapsed > 0 ? commands / elapsed : 0.0);
+	slash_printf(slash, "%-32s %10s %12s %12s\n", "command", "count", "mean us", "max us");
+	for (size_t i = 0; i < stat_count; i++) {
+		slash_printf(slash, "%-32s %10u %12.1f %12.1f\n", stats[i].name, stats[i].count,
+					 stats[i].total_ns / 1e3 / stats[i].count, stats[i].max_ns / 1e3);
+	}
+
+	close(null_fd);
+	free(line_buf);
+	free(data);
+	return commands;
+
+err:
+	if (fds[0] >= 0)
+		close(fds[0]);
+	if (fds[1] >= 0)
+		close(fds[1]);
+	if (null_fd >= 0)
+		close(null_fd);
+	free(line_buf);
+	free(data);
+	return -1;
+}
@@ -5,6 +5,8 @@
 #include <stdlib.h>
 #include <limits.h>
 
+#include "builtins.h"
+
 
 /* Implement this function to set environment variables for example */
 __attribute__((weak)) void slash_on_run_pre_hook(const char * const filename, void ** ctx_for_post) {  /* Set up environemnt variables for "run" command. */
@@ -20,53 +22,20 @@ __attribute__((weak)) void slash_on_run_post_hook(const char * const filename, v
 
 int slash_run(struct slash *slash, char * filename, int printcmd) {
 
+    /* Compile the whole file before running anything, so loops do not parse it again */
     char filename_local[256];
-    if (filename[0] == '~') {
-        strcpy(filename_local, getenv("HOME"));
-        strcpy(&filename_local[strlen(filename_local)], &filename[1]);
-    }
-    else {
-        strcpy(filename_local, filename);
-    }
-
-    /* Read from file */
-	FILE * stream = fopen(filename_local, "r");
-	if (stream == NULL) {
-        printf("  File %s not found\n", filename);
-		return SLASH_EIO;
+    struct slash_script *script;
+    int res = slash_script_load(slash, filename, filename_local, sizeof(filename_local), &script);
+    if (res != SLASH_SUCCESS) {
+        return res;
     }
 
-
     void *ctx_for_post = NULL;
     slash_on_run_pre_hook(filename_local, &ctx_for_post);
 
-    char line[512];
-    int ret = SLASH_SUCCESS;
-    while(fgets(line, sizeof(line), stream)) {
-        
-        /* Strip newline and carriage return */
-        line[strcspn(line, "\n\r")] = 0;
-
-        /* Skip short lines */
-        if (strlen(line) <= 1)
-            continue;
-
-        /* Skip comments */
-        if (line[0] == '#') {
-            continue;
-        }
-
-        if (printcmd)
-            printf("  run: %s\n", line);
-
-        ret = slash_execute(slash, line);
-        slash_history_add(slash, line);
-        if (ret == SLASH_EXIT || ret == SLASH_EBREAK) {
-            break;
-        }
-    }
+    int ret = slash_script_exec(slash, script, printcmd);
 
-    fclose(stream);
+    slash_script_free(script);
 
     slash_on_run_post_hook(filename_local, ctx_for_post);
 
@@ -76,22 +45,26 @@ int slash_run(struct slash *slash, char * filename, int printcmd) {
 
 static int cmd_run(struct slash *slash) {
 
+    /* Each line of the script gets the default deadline */
+    slash_timeout_nested(slash);
+
     int verbosity = 2;
 
-    optparse_t * parser = optparse_new("run", "<filename>");
+    optparse_t * parser = optparse_new_arena(slash_alloc(slash, OPTPARSE_ARENA_SIZE(2)), OPTPARSE_ARENA_SIZE(2), "run", "<filename>", NULL);
+    if (!parser) {
+        return SLASH_ENOMEM;
+    }
     optparse_add_int(parser, 'v', "verbosity", "NUM", 0, &verbosity, "verbosity (default = 2, max = 2)");
     optparse_add_help(parser);
 
     int argi = optparse_parse(parser, slash->argc - 1, (const char **) slash->argv + 1);
     if (argi < 0) {
-        optparse_del(parser);
 	    return SLASH_EINVAL;
     }
 
 	/* Check if name is present */
 	if (++argi >= slash->argc) {
 		printf("missing parameter filename\n");
-        optparse_del(parser);
 		return SLASH_EINVAL;
 	}
 
@@ -103,14 +76,17 @@ static int cmd_run(struct slash *slash) {
 
     const bool printcmd = verbosity >= 2;
 
-    const int res = slash_run(slash, name, printcmd);
-    optparse_del(parser);
-    return res;
+    return slash_run(slash, name, printcmd);
 
 }
 slash_command_completer(run, cmd_run, slash_path_completer, "<file>", "Runs commands in the specified file. \n"\
     "Sets the following environment variables during execution:\n\n"\
     "- __FILE__ to the path and name of the executed file\n"\
-    "- __FILE_DIR__ to the directory containing the executed file, useful for running other files located relative to __FILE__")
+    "- __FILE_DIR__ to the directory containing the executed file, useful for running other files located relative to __FILE__\n\n"\
+    "Besides commands, the file may contain:\n\n"\
+    "- repeat <count> ... end\n"\
+    "- for <name> in <items...> ... end, with the item in $name\n"\
+    "- if $? [== | != | < | > | <= | >= <value>] ... [else ...] end, testing the result of the last command\n"\
+    "- :<label> and goto <label>")
 /* TODO: Documenting __FILE__ and __FILE_DIR__ is incorrect.
     They are implemented in hooks, but right now we don't have a way to document them there. */
@@ -0,0 +1,480 @@
+#include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <slash/slash.h>
+
+#include "builtins.h"
+
+/* Scripts are compiled to a flat list of instructions, blocks become jumps */
+enum slash_script_op {
+	SLASH_SCRIPT_EXEC,	/* Execute text */
+	SLASH_SCRIPT_JUMP,	/* Continue at target */
+	SLASH_SCRIPT_REPEAT,	/* Set the counter of slot to value, skip to target if it is zero */
+	SLASH_SCRIPT_LOOP,	/* Decrement the counter of slot, continue at target until it is zero */
+	SLASH_SCRIPT_FOR,	/* Set the item index of slot to value, the first item */
+	SLASH_SCRIPT_NEXT,	/* Set the variable text to the next item, or skip to target after the last one */
+	SLASH_SCRIPT_IF,	/* Skip to target unless the last result compares to value */
+};
+
+enum slash_script_cmp {
+	SLASH_SCRIPT_EQ,
+	SLASH_SCRIPT_NE,
+	SLASH_SCRIPT_LT,
+	SLASH_SCRIPT_GT,
+	SLASH_SCRIPT_LE,
+	SLASH_SCRIPT_GE,
+};
+
+struct slash_script_insn {
+	enum slash_script_op op;
+	enum slash_script_cmp cmp;
+	int value;
+	unsigned int slot;
+	unsigned int target;
+	unsigned int line;
+	char *text;
+	char **items;
+	int item_count;
+	/* The command of an executed line, looked up once, NULL when slash_execute() does it each time */
+	struct slash_prepared *prepared;
+};
+
+struct slash_script {
+	/* The file, split into lines that the instructions point into */
+	char *source;
+	struct slash_script_insn *insns;
+	unsigned int count;
+	unsigned int size;
+	unsigned int slots;
+	size_t line_max;
+};
+
+/* Open blocks and labels while compiling */
+#define SLASH_SCRIPT_DEPTH	16
+
+struct slash_script_label {
+	const char *name;
+	unsigned int target;
+};
+
+static struct slash_script_insn *slash_script_emit(struct slash_script *script, enum slash_script_op op, unsigned int line)
+{
+	if (script->count == script->size) {
+		unsigned int size = script->size ? script->size * 2 : 64;
+		struct slash_script_insn *insns = realloc(script->insns, size * sizeof(*insns));
+		if (!insns)
+			return NULL;
+		script->insns = insns;
+		script->size = size;
+	}
+
+	struct slash_script_insn *insn = &script->insns[script->count++];
+	memset(insn, 0, sizeof(*insn));
+	insn->op = op;
+	insn->line = line;
+
+	return insn;
+}
+
+/* Split the arguments of a directive in place, with the quoting rules of commands */
+static char **slash_script_args(char *args, int *argc)
+{
+	if (slash_build_args(args, NULL, argc) < 0)
+		return NULL;
+
+	char **argv = calloc(*argc + 1, sizeof(*argv));
+	if (argv)
+		slash_build_args(args, argv, argc);
+
+	return argv;
+}
+
+static bool slash_script_word(const char *line, const char *word, char **rest)
+{
+	size_t len = strlen(word);
+	if (strncmp(line, word, len) != 0 || (line[len] != '\0' && line[len] != ' '))
+		return false;
+
+	line += len;
+	while (*line == ' ')
+		line++;
+	*rest = (char *) line;
+
+	return true;
+}
+
+static int slash_script_condition(char *cond, enum slash_script_cmp *cmp, int *value)
+{
+	static const char *ops[] = {
+		[SLASH_SCRIPT_EQ] = "==", [SLASH_SCRIPT_NE] = "!=",
+		[SLASH_SCRIPT_LT] = "<", [SLASH_SCRIPT_GT] = ">",
+		[SLASH_SCRIPT_LE] = "<=", [SLASH_SCRIPT_GE] = ">=",
+	};
+
+	char *rest;
+	if (!slash_script_word(cond, "$?", &rest))
+		return -1;
+
+	/* "if $?" alone is true when the last command failed */
+	if (*rest == '\0') {
+		*cmp = SLASH_SCRIPT_NE;
+		*value = 0;
+		return 0;
+	}
+
+	for (unsigned int i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+		char *number;
+		if (slash_script_word(rest, ops[i], &number)) {
+			char *end;
+			*cmp = i;
+			*value = strtol(number, &end, 0);
+			return (end == number || *end != '\0') ? -1 : 0;
+		}
+	}
+
+	return -1;
+}
+
+void slash_script_free(struct slash_script *script)
+{
+	if (!script)
+		return;
+
+	for (unsigned int i = 0; i < script->count; i++) {
+		free(script->insns[i].items);
+		if (script->insns[i].prepared) {
+			slash_prepared_free(script->insns[i].prepared);
+			free(script->insns[i].prepared);
+		}
+	}
+	free(script->insns);
+	free(script->source);
+	free(script);
+}
+
+struct slash_script *slash_script_compile(struct slash *slash, char *source)
+{
+	struct slash_script *script = calloc(1, sizeof(*script));
+	if (!script) {
+		free(source);
+		return NULL;
+	}
+	script->source = source;
+
+	unsigned int blocks[SLASH_SCRIPT_DEPTH];
+	unsigned int depth = 0;
+	struct slash_script_label *labels = NULL;
+	unsigned int label_count = 0;
+	unsigned int line_number = 0;
+	const char *error = NULL;
+
+	char *next = source;
+	while (next && !error) {
+		char *line = next;
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = '\0';
+		line_number++;
+
+		/* Strip the carriage return and the indentation */
+		line[strcspn(line, "\r")] = '\0';
+		while (isspace((unsigned char) *line))
+			line++;
+
+		/* Skip short lines and comments */
+		if (strlen(line) <= 1 || line[0] == '#')
+			continue;
+
+		char *rest;
+		struct slash_script_insn *insn;
+		size_t len = strlen(line);
+
+		/* A label, ":" starts no command */
+		if (line[0] == ':') {
+			line++;
+			if (strchr(line, ' ')) {
+				error = "usage: :<label>";
+				break;
+			}
+			for (unsigned int l = 0; l < label_count && !error; l++) {
+				if (strcmp(labels[l].name, line) == 0)
+					error = "duplicate label";
+			}
+			if (error)
+				break;
+			struct slash_script_label *grown = realloc(labels, (label_count + 1) * sizeof(*labels));
+			if (!grown) {
+				error = "out of memory";
+				break;
+			}
+			labels = grown;
+			labels[label_count].name = line;
+			labels[label_count++].target = script->count;
+			continue;
+		}
+
+		bool opens = slash_script_word(line, "repeat", &rest) || slash_script_word(line, "for", &rest) ||
+			slash_script_word(line, "if", &rest);
+		if (opens && depth == SLASH_SCRIPT_DEPTH) {
+			error = "blocks nested too deep";
+			break;
+		}
+
+		if (slash_script_word(line, "repeat", &rest)) {
+			char *end;
+			long count = strtol(rest, &end, 0);
+			if (end == rest || *end != '\0' || count < 0) {
+				error = "usage: repeat <count>";
+				break;
+			}
+			insn = slash_script_emit(script, SLASH_SCRIPT_REPEAT, line_number);
+			if (insn) {
+				insn->value = count;
+				insn->slot = script->slots++;
+				blocks[depth++] = script->count - 1;
+			}
+		} else if (slash_script_word(line, "for", &rest)) {
+			int argc;
+			char **argv = slash_script_args(rest, &argc);
+			if (!argv || argc < 2 || strcmp(argv[1], "in") != 0) {
+				free(argv);
+				error = "usage: for <name> in <items...>";
+				break;
+			}
+			insn = slash_script_emit(script, SLASH_SCRIPT_FOR, line_number);
+			if (insn) {
+				/* Items start after "<name> in" */
+				insn->value = 2;
+				insn->slot = script->slots++;
+				insn = slash_script_emit(script, SLASH_SCRIPT_NEXT, line_number);
+			}
+			if (insn) {
+				insn->slot = script->slots - 1;
+				insn->text = argv[0];
+				insn->items = argv;
+				insn->item_count = argc;
+				blocks[depth++] = script->count - 1;
+			} else {
+				free(argv);
+			}
+		} else if (slash_script_word(line, "if", &rest)) {
+			insn = slash_script_emit(script, SLASH_SCRIPT_IF, line_number);
+			if (insn) {
+				if (slash_script_condition(rest, &insn->cmp, &insn->value) < 0) {
+					error = "usage: if $? [== | != | < | > | <= | >= <value>]";
+					break;
+				}
+				blocks[depth++] = script->count - 1;
+			}
+		} else if (slash_script_word(line, "else", &rest) && *rest == '\0') {
+			if (depth == 0 || script->insns[blocks[depth - 1]].op != SLASH_SCRIPT_IF) {
+				error = "else without if";
+				break;
+			}
+			insn = slash_script_emit(script, SLASH_SCRIPT_JUMP, line_number);
+			if (insn) {
+				/* The if skips to the else branch, the end of the then branch jumps over it */
+				script->insns[blocks[depth - 1]].target = script->count;
+				blocks[depth - 1] = script->count - 1;
+			}
+		} else if (slash_script_word(line, "end", &rest) && *rest == '\0') {
+			if (depth == 0) {
+				error = "end without block";
+				break;
+			}
+			unsigned int start = blocks[--depth];
+			insn = &script->insns[start];
+			if (insn->op == SLASH_SCRIPT_REPEAT) {
+				insn = slash_script_emit(script, SLASH_SCRIPT_LOOP, line_number);
+				if (insn) {
+					insn->slot = script->insns[start].slot;
+					insn->target = start + 1;
+				}
+			} else if (insn->op == SLASH_SCRIPT_NEXT) {
+				insn = slash_script_emit(script, SLASH_SCRIPT_JUMP, line_number);
+				if (insn)
+					insn->target = start;
+			}
+			script->insns[start].target = script->count;
+		} else if (slash_script_word(line, "goto", &rest)) {
+			insn = slash_script_emit(script, SLASH_SCRIPT_JUMP, line_number);
+			if (insn) {
+				/* Resolved when all labels are known */
+				insn->target = UINT_MAX;
+				insn->text = rest;
+			}
+		} else {
+			insn = slash_script_emit(script, SLASH_SCRIPT_EXEC, line_number);
+			if (insn) {
+				insn->text = line;
+				script->line_max = slash_max(script->line_max, len);
+
+				/* Commands not known yet, loaded by an earlier line for example, are looked up when executed */
+				insn->prepared = malloc(sizeof(*insn->prepared));
+				if (insn->prepared && slash_prepare(slash, insn->prepared, line) < 0) {
+					free(insn->prepared);
+					insn->prepared = NULL;
+				}
+			}
+		}
+
+		if (!insn)
+			error = "out of memory";
+	}
+
+	if (!error && depth > 0) {
+		line_number = script->insns[blocks[depth - 1]].line;
+		error = "block without end";
+	}
+
+	for (unsigned int i = 0; i < script->count && !error; i++) {
+		struct slash_script_insn *insn = &script->insns[i];
+		if (insn->op != SLASH_SCRIPT_JUMP || insn->target != UINT_MAX)
+			continue;
+		for (unsigned int l = 0; l < label_count; l++) {
+			if (strcmp(labels[l].name, insn->text) == 0)
+				insn->target = labels[l].target;
+		}
+		if (insn->target == UINT_MAX) {
+			line_number = insn->line;
+			error = "no such label";
+		}
+	}
+
+	free(labels);
+
+	if (error) {
+		slash_printf(slash, "  line %u: %s\n", line_number, error);
+		slash_script_free(script);
+		return NULL;
+	}
+
+	return script;
+}
+
+int slash_script_load(struct slash *slash, const char *filename, char *path, size_t path_size, struct slash_script **script)
+{
+	if (filename[0] == '~') {
+		const char *home = getenv("HOME");
+		snprintf(path, path_size, "%s%s", home ? home : "", &filename[1]);
+	} else {
+		snprintf(path, path_size, "%s", filename);
+	}
+
+	FILE *stream = fopen(path, "r");
+	if (stream == NULL) {
+		printf("  File %s not found\n", filename);
+		return SLASH_EIO;
+	}
+
+	char *source = NULL;
+	if (fseek(stream, 0, SEEK_END) == 0) {
+		long size = ftell(stream);
+		rewind(stream);
+		if (size >= 0 && (source = malloc(size + 1)) != NULL)
+			source[fread(source, 1, size, stream)] = '\0';
+	}
+	fclose(stream);
+	if (source == NULL) {
+		printf("  Failed to read %s\n", filename);
+		return SLASH_EIO;
+	}
+
+	*script = slash_script_compile(slash, source);
+	return *script ? SLASH_SUCCESS : SLASH_EINVAL;
+}
+
+static bool slash_script_compare(enum slash_script_cmp cmp, int a, int b)
+{
+	switch (cmp) {
+	case SLASH_SCRIPT_EQ: return a == b;
+	case SLASH_SCRIPT_NE: return a != b;
+	case SLASH_SCRIPT_LT: return a < b;
+	case SLASH_SCRIPT_GT: return a > b;
+	case SLASH_SCRIPT_LE: return a <= b;
+	case SLASH_SCRIPT_GE: return a >= b;
+	}
+	return false;
+}
+
+int slash_script_exec(struct slash *slash, const struct slash_script *script, int printcmd)
+{
+	/* The script may run outside of a command, keep its memory until it returns */
+	struct slash_arena_mark mark;
+	slash_arena_save(slash, &mark);
+
+	/* The loop state and the line being executed, which slash_execute() modifies */
+	int *state = slash_alloc(slash, slash_max(script->slots, 1u) * sizeof(*state));
+	char *line = slash_alloc(slash, script->line_max + 1);
+	if (!state || !line) {
+		slash_arena_restore(slash, &mark);
+		return SLASH_ENOMEM;
+	}
+
+	/* A script run outside of a command is not stopped by an earlier Ctrl-C */
+	if (!slash->busy)
+		slash->signal = 0;
+
+	int ret = SLASH_SUCCESS;
+	unsigned int pc = 0;
+	while (pc < script->count) {
+		const struct slash_script_insn *insn = &script->insns[pc++];
+
+		if (slash_should_abort(slash)) {
+			slash_printf(slash, "  line %u: %s\n", insn->line, slash->signal ? "interrupted" : "timed out");
+			ret = slash->signal ? SLASH_EBREAK : SLASH_ETIMEDOUT;
+			break;
+		}
+
+		switch (insn->op) {
+		case SLASH_SCRIPT_EXEC:
+			if (printcmd)
+				printf("  run: %s\n", insn->text);
+			if (insn->prepared) {
+				ret = slash_execute_prepared(slash, insn->prepared, line);
+			} else {
+				strcpy(line, insn->text);
+				ret = slash_execute(slash, line);
+			}
+			slash_history_add(slash, insn->text);
+			if (ret == SLASH_EXIT || ret == SLASH_EBREAK)
+				pc = script->count;
+			break;
+		case SLASH_SCRIPT_JUMP:
+			pc = insn->target;
+			break;
+		case SLASH_SCRIPT_REPEAT:
+			state[insn->slot] = insn->value;
+			if (insn->value == 0)
+				pc = insn->target;
+			break;
+		case SLASH_SCRIPT_LOOP:
+			if (--state[insn->slot] > 0)
+				pc = insn->target;
+			break;
+		case SLASH_SCRIPT_FOR:
+			state[insn->slot] = insn->value;
+			break;
+		case SLASH_SCRIPT_NEXT:
+			if (state[insn->slot] >= insn->item_count) {
+				pc = insn->target;
+			} else if (slash_var_set(slash, insn->text, insn->items[state[insn->slot]++]) < 0) {
+				slash_printf(slash, "  line %u: cannot set variable %s\n", insn->line, insn->text);
+				ret = SLASH_EINVAL;
+				pc = script->count;
+			}
+			break;
+		case SLASH_SCRIPT_IF:
+			if (!slash_script_compare(insn->cmp, ret, insn->value))
+				pc = insn->target;
+			break;
+		}
+	}
+
+	slash_arena_restore(slash, &mark);
+
+	return ret;
+}
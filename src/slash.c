@@ -24,6 +24,16 @@
 #include <slash/slash.h>
 #include <slash/optparse.h>
 #include <slash/completer.h>
+#ifdef SLASH_STATS
+#include <slash/stats.h>
+#endif
+#ifdef SLASH_RECORD
+#include <slash/record.h>
+#endif
+#ifdef SLASH_TRACE
+#include <slash/trace.h>
+#include <slash/table.h>
+#endif
 
 #include <dlfcn.h>
 #include <stdio.h>
@@ -38,6 +48,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <time.h>
+#include <limits.h>
 #include <sys/time.h>
 
 #ifdef SLASH_HAVE_TERMIOS_H
@@ -142,11 +153,22 @@ static int slash_configure_term(struct slash *slash)
 	if (slash_rawmode_enable(slash) < 0)
 		return -ENOTTY;
 
+	/* Bracketed paste, see slash_paste() */
+	if (!slash->paste_mode && isatty(slash->fd_write)) {
+		slash_write(slash, "\x1b[?2004h", 8);
+		slash->paste_mode = true;
+	}
+
 	return 0;
 }
 
 static int slash_restore_term(struct slash *slash)
 {
+	if (slash->paste_mode) {
+		slash_write(slash, "\x1b[?2004l", 8);
+		slash->paste_mode = false;
+	}
+
 	if (slash_rawmode_disable(slash) < 0)
 		return -ENOTTY;
 
@@ -191,9 +213,24 @@ static int slash_getchar(struct slash *slash)
 		return -EIO;
 	}
 
+#ifdef SLASH_RECORD
+	if (slash->record)
+		slash_record_keys(slash, (char *) &c, 1);
+#endif
+
 	return c;
 }
 
+/* Next key of the line, completing the line meanwhile when the candidates of a completer arrive */
+static int slash_getkey(struct slash *slash)
+{
+#ifdef SLASH_ASYNC
+	while (slash_async_wait(slash) > 0)
+		slash_refresh(slash, 0);
+#endif
+	return slash_getchar(slash);
+}
+
 #ifdef SLASH_HAVE_SELECT
 static int slash_wait_select(void *slashp, unsigned int ms)
 {
@@ -229,10 +266,90 @@ int slash_set_wait_interruptible(struct slash *slash, slash_waitfunc_t waitfunc)
 	return 0;
 }
 
+/* Deadlines only need millisecond precision, use the cheapest clock */
+static uint64_t slash_deadline_now(void)
+{
+	struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void slash_set_timeout(struct slash *slash, unsigned int ms)
+{
+	slash->timeout_ms = ms;
+}
+
+void slash_timeout_nested(struct slash *slash)
+{
+	if (slash->deadline_default) {
+		slash->deadline_ns = slash->deadline_outer;
+		slash->deadline_default = false;
+	}
+}
+
+int slash_remaining_ms(struct slash *slash)
+{
+	if (!slash->deadline_ns)
+		return -1;
+
+	uint64_t now = slash_deadline_now();
+	if (now >= slash->deadline_ns) {
+		slash->deadline_seen = true;
+		return 0;
+	}
+
+	return slash_min((slash->deadline_ns - now + 999999) / 1000000, (uint64_t) INT_MAX);
+}
+
+bool slash_should_abort(struct slash *slash)
+{
+	if (slash->signal)
+		return true;
+
+	if (slash->deadline_ns && slash_deadline_now() >= slash->deadline_ns) {
+		slash->deadline_seen = true;
+		return true;
+	}
+
+	return false;
+}
+
+/* Shorten the deadline of the executing command, returns the previous one */
+uint64_t slash_deadline_arm(struct slash *slash, unsigned int ms)
+{
+	uint64_t previous = slash->deadline_ns;
+
+	if (ms) {
+		uint64_t deadline = slash_deadline_now() + ms * 1000000ull;
+		if (!slash->deadline_ns || deadline < slash->deadline_ns)
+			slash->deadline_ns = deadline;
+	}
+
+	return previous;
+}
+
 int slash_wait_interruptible(struct slash *slash, unsigned int ms)
 {
-	if (slash->waitfunc)
-		return slash->waitfunc(slash, ms);
+	/* Do not wait past the deadline */
+	int remaining = slash_remaining_ms(slash);
+	if (remaining == 0)
+		return -ETIMEDOUT;
+	bool expires = remaining > 0 && (unsigned int) remaining <= ms;
+	if (expires)
+		ms = remaining;
+
+	if (slash->waitfunc) {
+		int ret = slash->waitfunc(slash, ms);
+		if (ret == 0 && expires) {
+			slash->deadline_seen = true;
+			return -ETIMEDOUT;
+		}
+		return ret;
+	}
 
 	return -ENOSYS;
 }
@@ -271,41 +388,22 @@ struct slash_command *
 slash_command_find(struct slash *slash, char *line, size_t linelen, char **args)
 {
 	(void)slash;
-	/* Maximum length match */
-	size_t max_matchlen = 0;
-	struct slash_command *max_match_cmd = NULL;
-
-	struct slash_command * cmd;
-	slash_list_iterator i = {0};
-	size_t cmd_length;
-	while ((cmd = slash_list_iterate(&i)) != NULL) {
-		cmd_length = strlen(cmd->name);
-		/* Find an exact match */
-		if (strncmp(line, cmd->name, cmd_length) == 0) {
-			/* Now, let's see if it is an actual exact match, or simply a prefix match 
-			as a prefix match can lead to "listttt" being interpreted as the valid "list" command
-			*/
-			if (linelen > cmd_length) {
-				/* If the input > match, check that the next character is a separator */
-				if(line[cmd_length] != ' ') {
-					continue;
-				}
-			}
-		} else {
-			continue;
-		}
 
-		/* Update the max-length match */
-		if (cmd_length > max_matchlen) {
-			max_match_cmd = cmd;
-			max_matchlen = cmd_length;
+	/* Maximum length match: try the whole line, then every prefix ending before a separator,
+	   as a prefix match can lead to "listttt" being interpreted as the valid "list" command */
+	for (size_t len = linelen; len > 0; len--) {
+		if (len < linelen && line[len] != ' ')
+			continue;
 
+		struct slash_command *cmd = slash_list_find_name_len(line, len);
+		if (cmd) {
 			/* Calculate arguments position */
-			*args = line + cmd_length;
+			*args = line + len;
+			return cmd;
 		}
 	}
 
-	return max_match_cmd;
+	return NULL;
 }
 
 int slash_build_args(char *args, char **argv, int *argc)
@@ -319,7 +417,7 @@ int slash_build_args(char *args, char **argv, int *argc)
 
 	*argc = 0;
 
-	while (*args && *argc < SLASH_ARG_MAX) {
+	while (*args) {
 		/* Check for quotes */
 		if (*args == '\'') {
 			quote = SLASH_QUOTE_SINGLE;
@@ -330,7 +428,9 @@ int slash_build_args(char *args, char **argv, int *argc)
 		}
 
 		/* Argument starts here */
-		argv[(*argc)++] = args;
+		if (argv)
+			argv[*argc] = args;
+		(*argc)++;
 
 		/* Loop over input argument */
 		while (*args) {
@@ -349,8 +449,11 @@ int slash_build_args(char *args, char **argv, int *argc)
 		}
 
 		/* End argument with zero byte */
-		if (*args)
-			*args++ = '\0';
+		if (*args) {
+			if (argv)
+				*args = '\0';
+			args++;
+		}
 
 		/* Skip trailing white space */
 		while (*args && *args == ' ')
@@ -362,7 +465,8 @@ int slash_build_args(char *args, char **argv, int *argc)
 		return -1;
 
 	/* According to C11 section 5.1.2.2.1, argv[argc] must be NULL */
-	argv[*argc] = NULL;
+	if (argv)
+		argv[*argc] = NULL;
 
 	return 0;
 }
@@ -377,6 +481,8 @@ void slash_command_usage(struct slash *slash, struct slash_command *command)
 	} else {
 		slash_printf(slash, "%s: %s %s\n", type, command->name, args);
 	}
+	if (command->opts)
+		slash_opts_help(slash, command->opts);
 }
 
 void slash_command_description(struct slash *slash, struct slash_command *command)
@@ -460,19 +566,183 @@ static void strip_comment(char *line) {
 	}
 }
 
+/* Run a command found and split by slash_execute() or slash_prepare(), inside a read-side section */
+static int slash_execute_command(struct slash *slash, struct slash_command *command, const char *args,
+								 int argc, char **argv, uint32_t args_digest)
+{
+	int ret;
+#ifndef SLASH_TRACE
+	(void) args_digest;
+#endif
+
+	/* Reset state for slash_getopt */
+	slash->optarg = 0;
+	slash->optind = 1;
+	slash->opterr = 1;
+	slash->optopt = '?';
+	slash->sp = 1;
+
+	const char *outer_args = slash->args;
+	slash->argc = argc;
+	slash->argv = argv;
+	slash->args = args;
+
+	/* Ctrl-C and the deadline of an outer command also stop the nested ones */
+	int busy = slash->busy;
+	if (!busy)
+		slash->signal = 0;
+	slash->busy = 1;
+	uint64_t deadline = slash->deadline_ns;
+	uint64_t deadline_outer = slash->deadline_outer;
+	bool deadline_default = slash->deadline_default;
+	bool deadline_seen = slash->deadline_seen;
+	slash->deadline_outer = deadline;
+	slash->deadline_default = false;
+	slash->deadline_seen = false;
+	/* The deadline given by timeout replaces the default one */
+	if (slash->deadline_explicit) {
+		slash->deadline_explicit = false;
+	} else if (slash->timeout_ms) {
+		slash_deadline_arm(slash, slash->timeout_ms);
+		slash->deadline_default = true;
+	}
+
+#if defined(SLASH_STATS) || defined(SLASH_TRACE)
+	struct timespec start, stop;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+#endif
+#ifdef SLASH_TRACE
+	/* Written before the command runs, so a crash dump shows the command that crashed */
+	uint64_t trace = slash_trace_begin(command, start.tv_sec * 1000000000ull + start.tv_nsec, args_digest);
+#endif
+	if (command->context) {
+		/* If the user has attached context to the command,
+			we assume they also specified a function which can accept it. */
+		ret = command->func_ctx(slash, command->context);
+	} else {
+		/* Otherwise call the traditional (`slash_command()` macro) function without context. */
+		ret = command->func(slash);
+	}
+	/* Only a command which stopped at its deadline timed out, one which ignored it just overran */
+	if (ret != SLASH_EXIT && ret != SLASH_ETIMEDOUT && slash->deadline_ns && slash_deadline_now() >= slash->deadline_ns) {
+		if (slash->deadline_seen) {
+			slash_printf(slash, "Timed out: %s\n", command->name);
+			ret = SLASH_ETIMEDOUT;
+		} else {
+			slash_printf(slash, "Deadline overrun: %s\n", command->name);
+		}
+	}
+	/* The outer command was told too, when its deadline was the one that passed */
+	slash->deadline_seen = deadline_seen || (slash->deadline_seen && deadline && slash_deadline_now() >= deadline);
+	slash->deadline_ns = deadline;
+	slash->deadline_outer = deadline_outer;
+	slash->deadline_default = deadline_default;
+	slash->busy = busy;
+	slash->args = outer_args;
+
+#if defined(SLASH_STATS) || defined(SLASH_TRACE)
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	uint64_t duration_ns = (stop.tv_sec - start.tv_sec) * 1000000000ull + stop.tv_nsec - start.tv_nsec;
+#endif
+#ifdef SLASH_STATS
+	slash_stats_record(command, duration_ns);
+#endif
+#ifdef SLASH_TRACE
+	slash_trace_end(trace, duration_ns, ret);
+#endif
+
+	if (ret == SLASH_EUSAGE)
+		slash_command_usage(slash, command);
+
+	return ret;
+}
+
+/* Find, split and run the expanded and processed line_to_use, line is the one given to the hooks.
+   Releases what was allocated since mark. */
+static int slash_execute_line(struct slash *slash, char *line, char *line_to_use, struct slash_arena_mark *mark)
+{
+	struct slash_command *command;
+	char *args, *argv_stack[SLASH_ARG_MAX + 1], **argv = argv_stack;
+	int ret, argc = 0;
+
+	/* The command and its code stay mapped until its last use, even if its APM is unloaded meanwhile */
+	slash_list_read_lock();
+	command = slash_command_find(slash, line_to_use, strlen(line_to_use), &args);
+	if (!command) {
+		slash_list_read_unlock();
+		/* Print the original line here, not the possibly processed one */
+		slash_printf(slash, "No such command: %s\n", line);
+		slash_suggest(slash, line_to_use);
+		slash_arena_restore(slash, mark);
+		return -ENOENT;
+	}
+
+	/* Implement this function to perform logging for example */
+	slash_on_execute_hook(line);
+
+#ifdef SLASH_RECORD
+	if (slash->record)
+		slash_record_line(slash, line);
+#endif
+
+	if (!command->func) {
+		slash_list_read_unlock();
+		slash_arena_restore(slash, mark);
+		return -EINVAL;
+	}
+
+	/* Before slash_build_args() splits them */
+	uint32_t args_digest = 0;
+#ifdef SLASH_TRACE
+	args_digest = slash_table_hash(args, strlen(args), 0);
+#endif
+
+	/* Split a copy, the line stays as typed for the command, see slash->args */
+	char *split = slash_alloc(slash, strlen(args) + 1);
+	if (!split) {
+		slash_list_read_unlock();
+		slash_arena_restore(slash, mark);
+		return SLASH_ENOMEM;
+	}
+	strcpy(split, args);
+
+	/* Count the args, argv is only allocated when they do not fit on the stack */
+	if (slash_build_args(split, NULL, &argc) < 0) {
+		slash_printf(slash, "Mismatched quotes\n");
+		slash_list_read_unlock();
+		slash_arena_restore(slash, mark);
+		return -EINVAL;
+	}
+	if (argc > SLASH_ARG_MAX) {
+		argv = slash_alloc(slash, (argc + 1) * sizeof(*argv));
+		if (!argv) {
+			slash_printf(slash, "Too many arguments: %d\n", argc);
+			slash_list_read_unlock();
+			slash_arena_restore(slash, mark);
+			return SLASH_ENOMEM;
+		}
+	}
+
+	/* Build args */
+	slash_build_args(split, argv, &argc);
+
+	ret = slash_execute_command(slash, command, args, argc, argv, args_digest);
+
+	slash_arena_restore(slash, mark);
+
+	slash_on_execute_post_hook(line, command);
+	slash_list_read_unlock();
+
+	return ret;
+}
+
 int slash_execute(struct slash *slash, char *org_line)
 {
 	char *line = org_line;
 	if (has_unicode(slash, line)) {
 		return EINVAL;
 	}
-	struct slash_command *command;
-	char *args, *argv[SLASH_ARG_MAX];
 	char *processed_cmd_line = NULL, *line_to_use;
-	int ret, argc = 0;
-
-	slash->busy = 1;
-	slash->signal = 0;
 
 	/* Skip comments */
 	if (line[0] == '#') {
@@ -483,73 +753,265 @@ int slash_execute(struct slash *slash, char *org_line)
 		line++;
 	strip_comment(line);
 
+	/* Everything allocated with slash_alloc() from here is released when the command returns */
+	struct slash_arena_mark mark;
+	slash_arena_save(slash, &mark);
+
+	/* Expand variables, the line is used as it is when there are none */
+	line_to_use = slash_expand(slash, line);
+	if (!line_to_use) {
+		slash_printf(slash, "Out of memory for the expanded line\n");
+		slash_arena_restore(slash, &mark);
+		return SLASH_ENOMEM;
+	}
+
 	if(NULL != slash_process_cmd_line_hook) {
-		processed_cmd_line = slash_process_cmd_line_hook(line);
+		processed_cmd_line = slash_process_cmd_line_hook(line_to_use);
 	}
 
 	if (processed_cmd_line != NULL) {
 		line_to_use = processed_cmd_line;
-	} else {
-		line_to_use = line;
 	}
 
-	command = slash_command_find(slash, line_to_use, strlen(line_to_use), &args);
-	if (!command) {
-		/* Print the original line here, not the possibly processed one */
-		slash_printf(slash, "No such command: %s\n", line);
-		/* Yes, processed_cmd_line maybe NULL, but the man page says it's ok, so we save an "if" statement */
-		free(processed_cmd_line);
-		return -ENOENT;
+	int ret = slash_execute_line(slash, line, line_to_use, &mark);
+
+	/* Yes, processed_cmd_line maybe NULL, but the free() man page says it's ok, so we save an "if" statement */
+	free(processed_cmd_line);
+
+	return ret;
+}
+
+int slash_prepare(struct slash *slash, struct slash_prepared *prepared, const char *line)
+{
+	memset(prepared, 0, sizeof(*prepared));
+
+	/* Lines which slash_execute() refuses are left to it */
+	for (const unsigned char *c = (const unsigned char *) line; *c != '\0'; c++) {
+		if (*c & 0x80)
+			return -1;
 	}
 
-	/* Implement this function to perform logging for example */
-	slash_on_execute_hook(line);
+	while (*line && isspace((unsigned int) *line))
+		line++;
+	if (line[0] == '#')
+		return -1;
 
-	if (!command->func) {
-		/* Yes, processed_cmd_line maybe NULL, but the free() man page says it's ok, so we save an "if" statement */
-		free(processed_cmd_line);
-		return -EINVAL;
+	prepared->text = strdup(line);
+	if (!prepared->text)
+		return -1;
+	strip_comment(prepared->text);
+
+	slash_list_read_lock();
+	char *args;
+	struct slash_command *command = slash_command_find(slash, prepared->text, strlen(prepared->text), &args);
+	prepared->generation = slash_list_generation();
+	slash_list_read_unlock();
+	if (!command || !command->func)
+		goto err;
+
+	prepared->command = command;
+	prepared->args_offset = args - prepared->text;
+#ifdef SLASH_TRACE
+	prepared->args_digest = slash_table_hash(args, strlen(args), 0);
+#endif
+
+	/* A variable in the command name may make it another command each time */
+	unsigned int ref_count = slash_var_refs(prepared->text, NULL, 0);
+	if (ref_count > 0) {
+		prepared->refs = malloc(ref_count * sizeof(*prepared->refs));
+		prepared->ref_args = malloc(ref_count * sizeof(*prepared->ref_args));
+		if (!prepared->refs || !prepared->ref_args)
+			goto err;
+		slash_var_refs(prepared->text, prepared->refs, ref_count);
+		if (prepared->refs[0].offset < prepared->args_offset)
+			goto err;
+		prepared->ref_count = ref_count;
+		prepared->ref_start = prepared->refs[0].offset;
 	}
 
-	/* Build args */
-	if (slash_build_args(args, argv, &argc) < 0) {
-		slash_printf(slash, "Mismatched quotes\n");
-		/* Yes, processed_cmd_line maybe NULL, but the free() man page says it's ok, so we save an "if" statement */
+	/* Split a copy, the arguments are stored one after the other with their zero bytes */
+	char *split = strdup(args);
+	if (!split)
+		goto err;
+	char **argv = NULL;
+	int argc;
+	if (slash_build_args(split, NULL, &argc) < 0 || (argv = malloc((argc + 1) * sizeof(*argv))) == NULL) {
+		free(split);
+		goto err;
+	}
+	slash_build_args(split, argv, &argc);
+
+	size_t size = 0;
+	for (int i = 0; i < argc; i++)
+		size += strlen(argv[i]) + 1;
+	prepared->args = malloc(size ? size : 1);
+	if (prepared->args) {
+		/* A variable is within one argument, it has no space nor quote. Its offsets are moved
+		   from the line to the stored arguments */
+		char *p = prepared->args;
+		unsigned int r = 0;
+		for (int i = 0; i < argc; i++) {
+			size_t start = prepared->args_offset + (argv[i] - split);
+			size_t end = start + strlen(argv[i]);
+			for (; r < prepared->ref_count && prepared->refs[r].offset < end; r++) {
+				prepared->refs[r].offset += (p - prepared->args) - start;
+				prepared->refs[r].name_offset += (p - prepared->args) - start;
+				prepared->ref_args[r] = i;
+			}
+			p = stpcpy(p, argv[i]) + 1;
+		}
+		prepared->args_size = size;
+		prepared->argc = argc;
+	}
+	free(argv);
+	free(split);
+	if (!prepared->args)
+		goto err;
+
+	return 0;
+
+err:
+	slash_prepared_free(prepared);
+	return -1;
+}
+
+/* The values of the variables go into the arguments as they are, unless they would split them
+   otherwise or give a longer command name. Stores the values, NULL for the unset variables */
+static bool slash_prepared_fits(struct slash *slash, struct slash_prepared *prepared, const char *expanded,
+								const char **values)
+{
+	for (unsigned int r = 0; r < prepared->ref_count; r++) {
+		const struct slash_var_ref *ref = &prepared->refs[r];
+		values[r] = slash_var_value(slash, prepared->args + ref->name_offset, ref->name_length);
+		if (values[r] && (*values[r] == '\0' || strpbrk(values[r], " '\"")))
+			return false;
+	}
+
+	/* The names shorter than where the first variable starts were looked up already */
+	size_t len = strlen(expanded);
+	for (size_t l = len; l > prepared->ref_start; l--) {
+		if (l < len && expanded[l] != ' ')
+			continue;
+		if (slash_list_find_name_len(expanded, l))
+			return false;
+	}
+
+	return true;
+}
+
+int slash_execute_prepared(struct slash *slash, struct slash_prepared *prepared, char *line)
+{
+	struct slash_arena_mark mark;
+	slash_arena_save(slash, &mark);
+
+	slash_list_read_lock();
+
+	/* Commands were added or removed, find the command again the way slash_execute() does */
+	if (prepared->generation != slash_list_generation()) {
+		char *args;
+		struct slash_command *command = slash_command_find(slash, prepared->text, strlen(prepared->text), &args);
+		if (!command || !command->func || (size_t) (args - prepared->text) != prepared->args_offset) {
+			slash_list_read_unlock();
+			slash_arena_restore(slash, &mark);
+			strcpy(line, prepared->text);
+			return slash_execute(slash, line);
+		}
+		prepared->command = command;
+		prepared->generation = slash_list_generation();
+	}
+
+	/* The line as slash_execute() would give it to the command, and to slash_process_cmd_line_hook */
+	char *expanded = prepared->text;
+	const char **values = NULL;
+	if (prepared->ref_count > 0) {
+		expanded = slash_expand(slash, prepared->text);
+		values = slash_alloc(slash, prepared->ref_count * sizeof(*values));
+		if (!expanded || !values) {
+			slash_list_read_unlock();
+			slash_arena_restore(slash, &mark);
+			return SLASH_ENOMEM;
+		}
+	}
+
+	char *processed_cmd_line = NULL;
+	if (slash_process_cmd_line_hook)
+		processed_cmd_line = slash_process_cmd_line_hook(expanded);
+
+	/* A line the hook rewrote, or whose variables do not fit the arguments, is run as a whole */
+	if (processed_cmd_line || (expanded != prepared->text && !slash_prepared_fits(slash, prepared, expanded, values))) {
+		slash_list_read_unlock();
+		int ret = slash_execute_line(slash, prepared->text, processed_cmd_line ? processed_cmd_line : expanded, &mark);
 		free(processed_cmd_line);
-		return -EINVAL;
+		return ret;
 	}
 
-	/* Reset state for slash_getopt */
-	slash->optarg = 0;
-	slash->optind = 1;
-	slash->opterr = 1;
-	slash->optopt = '?';
-	slash->sp = 1;
+	slash_on_execute_hook(prepared->text);
 
-	slash->argc = argc;
-	slash->argv = argv;
-	if (command->context) {
-		/* If the user has attached context to the command,
-			we assume they also specified a function which can accept it. */
-		ret = command->func_ctx(slash, command->context);
-	} else {
-		/* Otherwise call the traditional (`slash_command()` macro) function without context. */
-		ret = command->func(slash);
+#ifdef SLASH_RECORD
+	if (slash->record)
+		slash_record_line(slash, prepared->text);
+#endif
+
+	/* Commands may modify their arguments, they get a copy, with the values of the variables */
+	size_t size = prepared->args_size;
+	if (expanded != prepared->text) {
+		for (unsigned int r = 0; r < prepared->ref_count; r++) {
+			if (values[r])
+				size += strlen(values[r]) - prepared->refs[r].length;
+		}
 	}
+	char *args = slash_alloc(slash, size ? size : 1);
+	char **argv = slash_alloc(slash, (prepared->argc + 1) * sizeof(*argv));
+	if (!args || !argv) {
+		slash_list_read_unlock();
+		slash_arena_restore(slash, &mark);
+		return SLASH_ENOMEM;
+	}
+	const char *src = prepared->args;
+	unsigned int r = expanded != prepared->text ? 0 : prepared->ref_count;
+	for (int i = 0; i < prepared->argc; i++) {
+		argv[i] = args;
+		const char *end = src + strlen(src);
+		for (; r < prepared->ref_count && prepared->ref_args[r] == i; r++) {
+			if (!values[r])
+				continue;
+			const char *at = prepared->args + prepared->refs[r].offset;
+			memcpy(args, src, at - src);
+			args = stpcpy(args + (at - src), values[r]);
+			src = at + prepared->refs[r].length;
+		}
+		memcpy(args, src, end - src + 1);
+		args += end - src + 1;
+		src = end + 1;
+	}
+	argv[prepared->argc] = NULL;
 
-	if (ret == SLASH_EUSAGE)
-		slash_command_usage(slash, command);
+	uint32_t args_digest = prepared->args_digest;
+#ifdef SLASH_TRACE
+	if (expanded != prepared->text)
+		args_digest = slash_table_hash(expanded + prepared->args_offset, strlen(expanded + prepared->args_offset), 0);
+#endif
 
-	slash_on_execute_post_hook(line, command);
+	int ret = slash_execute_command(slash, prepared->command, expanded + prepared->args_offset,
+									prepared->argc, argv, args_digest);
 
-	/* Yes, processed_cmd_line maybe NULL, but the free() man page says it's ok, so we save an "if" statement */
-	free(processed_cmd_line);
+	slash_arena_restore(slash, &mark);
 
-	slash->busy = 0;
+	slash_on_execute_post_hook(prepared->text, prepared->command);
+	slash_list_read_unlock();
 
 	return ret;
 }
 
+void slash_prepared_free(struct slash_prepared *prepared)
+{
+	free(prepared->text);
+	free(prepared->args);
+	free(prepared->refs);
+	free(prepared->ref_args);
+	memset(prepared, 0, sizeof(*prepared));
+}
+
 /* History */
 char *slash_history_increment(struct slash *slash, char *ptr)
 {
@@ -598,6 +1060,38 @@ static size_t slash_history_strlen(struct slash *slash, char *ptr)
 	return len;
 }
 
+/* Compare an entry with the line, or with another entry when ring is set */
+bool slash_history_equal(struct slash *slash, char *entry, char *s, bool ring)
+{
+	while (*entry == *s && *entry != '\0') {
+		entry = slash_history_increment(slash, entry);
+		s = ring ? slash_history_increment(slash, s) : s + 1;
+	}
+
+	return *entry == *s;
+}
+
+/* Where ptr went after the entry at removed and len bytes long was taken out of the ring */
+char *slash_history_moved(struct slash *slash, char *ptr, char *removed, size_t len)
+{
+	ptrdiff_t size = slash->history_size;
+	ptrdiff_t offset = ptr - slash->history_head;
+	ptrdiff_t start = removed - slash->history_head;
+
+	if (offset < 0)
+		offset += size;
+	if (start < 0)
+		start += size;
+	if (offset <= start)
+		return ptr;
+
+	ptr -= len;
+	if (ptr < slash->history)
+		ptr += size;
+
+	return ptr;
+}
+
 static void slash_history_copy(struct slash *slash, char *dst, char *src, size_t len)
 {
 	while (len--) {
@@ -656,13 +1150,20 @@ static char *slash_history_search_forward(struct slash *slash,
 
 static void slash_history_pull(struct slash *slash, size_t len)
 {
-	while (len-- > 0)
-		slash_history_push_head(slash);
-	while (*slash->history_head != '\0')
-		slash_history_push_head(slash);
+	/* Whole entries, each leaving the index first */
+	size_t freed = 0;
+	while (freed < len) {
+		slash_autosuggest_remove(slash, slash->history_head);
+		slash_history_unique_remove(slash, slash->history_head);
+		while (*slash->history_head != '\0') {
+			slash_history_push_head(slash);
+			freed++;
+		}
 
-	/* Push past final zero byte */
-	slash_history_push_head(slash);
+		/* Push past final zero byte */
+		slash_history_push_head(slash);
+		freed++;
+	}
 }
 
 static void slash_history_push(struct slash *slash, char *buf, size_t len)
@@ -672,14 +1173,50 @@ static void slash_history_push(struct slash *slash, char *buf, size_t len)
 		slash_history_pull(slash, len - slash->history_avail);
 
 	/* Copy to history */
+	char *entry = slash->history_tail;
 	while (len--)
 		slash_history_push_tail(slash, *buf++);
 
 	slash->history_cursor = slash->history_tail;
+	slash_autosuggest_add(slash, entry);
+	slash_history_unique_add(slash, entry);
+}
+
+/* Take an entry out of the middle of the ring, the newer entries move back over it */
+static void slash_history_remove(struct slash *slash, char *entry)
+{
+	size_t len = slash_history_strlen(slash, entry) + 1;
+	slash_autosuggest_remove(slash, entry);
+	slash_history_unique_remove(slash, entry);
+
+	char *dst = entry, *src = entry;
+	for (size_t i = 0; i < len; i++)
+		src = slash_history_increment(slash, src);
+	while (src != slash->history_tail) {
+		*dst = *src;
+		dst = slash_history_increment(slash, dst);
+		src = slash_history_increment(slash, src);
+	}
+
+	slash->history_tail = dst;
+	slash->history_avail += len;
+	while (dst != src) {
+		*dst = '\0';
+		dst = slash_history_increment(slash, dst);
+	}
+
+	slash_autosuggest_moved(slash, entry, len);
+	slash_history_unique_moved(slash, entry, len);
 }
 
 static void slash_history_rewind(struct slash *slash, size_t len)
 {
+	char *entry = slash->history_tail;
+	for (size_t i = 0; i < len; i++)
+		entry = slash_history_decrement(slash, entry);
+	slash_autosuggest_remove(slash, entry);
+	slash_history_unique_remove(slash, entry);
+
 	while (len-- > 0)
 		slash_history_pull_tail(slash);
 
@@ -688,6 +1225,35 @@ static void slash_history_rewind(struct slash *slash, size_t len)
 	slash->history_rewind_length = 0;
 }
 
+/* Append a line unless it is empty or the last entry, an older copy is moved when unique is set */
+static bool slash_history_append(struct slash *slash, char *line, bool unique)
+{
+	slash->history_cursor = slash->history_tail;
+
+	/* Check if last command was similar */
+	size_t srclen;
+	char *src = slash_history_search_back(slash, slash->history_cursor, &srclen);
+	if (src && slash_history_equal(slash, src, line, false))
+		return false;
+
+	if (slash_line_empty(line, strlen(line)))
+		return false;
+
+	/* A line grown past the size of the history is not kept */
+	if (strlen(line) + 1 >= slash->history_size)
+		return false;
+
+	/* Only once in the history */
+	char *entry = unique ? slash_history_unique_find(slash, line) : NULL;
+	if (entry)
+		slash_history_remove(slash, entry);
+
+	/* Push including trailing zero */
+	slash_history_push(slash, line, strlen(line) + 1);
+
+	return true;
+}
+
 void slash_history_add(struct slash *slash, char *line)
 {
 	/* Check if we are browsing history and clear latest entry */
@@ -697,17 +1263,8 @@ void slash_history_add(struct slash *slash, char *line)
 	/* Reset history depth */
 	slash->history_depth = 0;
 	slash->history_rewind_length = 0;
-	slash->history_cursor = slash->history_tail;
 
-	/* Check if last command was similar */
-	size_t srclen;
-	char *src = slash_history_search_back(slash, slash->history_cursor, &srclen);
-	if ((src) && (strlen(line) == srclen) && (strncmp(src, line, srclen) == 0))
-		return;
-
-	/* Push including trailing zero */
-	if (!slash_line_empty(line, strlen(line)))
-		slash_history_push(slash, line, strlen(line) + 1);
+	slash_history_append(slash, line, true);
 }
 
 static void slash_history_next(struct slash *slash)
@@ -742,8 +1299,9 @@ static void slash_history_previous(struct slash *slash)
 	/* Store current buffer temporarily */
 	buflen = strlen(slash->buffer);
 	if (!slash->history_depth && buflen) {
-		slash_history_add(slash, slash->buffer);
-		slash->history_rewind_length = buflen + 1;
+		/* Unless it was not added, being empty or the same as the last entry */
+		if (slash_history_append(slash, slash->buffer, false))
+			slash->history_rewind_length = buflen + 1;
 	}
 
 	slash->history_depth++;
@@ -754,17 +1312,104 @@ static void slash_history_previous(struct slash *slash)
 }
 
 /* Line editing */
+
+/**
+ * While editing in the middle of the line, the text after the cursor is kept at the end of the
+ * buffer, so characters are inserted and deleted at the cursor without moving it. The gap in
+ * between is closed again before anything else reads the line.
+ */
+static void slash_gap_open(struct slash *slash)
+{
+	if (slash->gap > 0)
+		return;
+
+	slash->gap = slash->line_size - 1 - slash->length;
+	memmove(&slash->buffer[slash->cursor + slash->gap], &slash->buffer[slash->cursor],
+		slash->length - slash->cursor);
+	slash->buffer[slash->line_size - 1] = '\0';
+}
+
+void slash_gap_close(struct slash *slash)
+{
+	if (slash->gap == 0)
+		return;
+
+	memmove(&slash->buffer[slash->cursor], &slash->buffer[slash->cursor + slash->gap],
+		slash->length - slash->cursor);
+	slash->buffer[slash->length] = '\0';
+	slash->gap = 0;
+}
+
+int slash_set_line_max(struct slash *slash, size_t line_max)
+{
+	if (line_max < slash->line_size || (!slash->line_owned && line_max > slash->line_size))
+		return SLASH_EINVAL;
+
+	slash->line_max = line_max;
+
+	return SLASH_SUCCESS;
+}
+
+/* Double the line buffer, up to line_max */
+static bool slash_line_grow(struct slash *slash)
+{
+	if (!slash->line_owned || slash->line_size >= slash->line_max)
+		return false;
+
+	size_t size = slash_min(slash->line_size * 2, slash->line_max);
+	char *buffer = realloc(slash->buffer, size);
+	if (!buffer)
+		return false;
+
+	/* The text after the gap stays at the end */
+	if (slash->gap > 0) {
+		size_t tail = slash->length - slash->cursor + 1;
+		memmove(&buffer[size - tail], &buffer[slash->line_size - tail], tail);
+		slash->gap += size - slash->line_size;
+	}
+
+	slash->buffer = buffer;
+	slash->line_size = size;
+
+	return true;
+}
+
+/* Insert text at the cursor in one copy, as much as fits */
+static void slash_insert_text(struct slash *slash, const char *text, size_t len)
+{
+	while (slash->length + len >= slash->line_size && slash_line_grow(slash))
+		;
+	if (slash->length + len >= slash->line_size) {
+		len = slash->line_size - 1 - slash->length;
+		slash_bell(slash);
+	}
+
+	slash_gap_open(slash);
+	memcpy(&slash->buffer[slash->cursor], text, len);
+	slash->cursor += len;
+	slash->length += len;
+	slash->gap -= len;
+}
+
 static void slash_insert(struct slash *slash, int c)
 {
-	if (slash->length + 1 < slash->line_size) {
-		memmove(&slash->buffer[slash->cursor + 1],
-			&slash->buffer[slash->cursor],
-			slash->length - slash->cursor);
-		slash->buffer[slash->cursor] = c;
-		slash->cursor++;
+	if (slash->length + 1 >= slash->line_size && !slash_line_grow(slash)) {
+		/* The line is full */
+		slash_bell(slash);
+		return;
+	}
+
+	if (slash->cursor == slash->length && slash->gap == 0) {
+		slash->buffer[slash->cursor++] = c;
 		slash->length++;
 		slash->buffer[slash->length] = '\0';
+		return;
 	}
+
+	slash_gap_open(slash);
+	slash->buffer[slash->cursor++] = c;
+	slash->length++;
+	slash->gap--;
 }
 
 int slash_refresh(struct slash *slash, int printtime)
@@ -772,7 +1417,8 @@ int slash_refresh(struct slash *slash, int printtime)
 	char esc[16];
 
 	/* Ensure line is zero terminated */
-	slash->buffer[slash->length] = '\0';
+	if (slash->gap == 0)
+		slash->buffer[slash->length] = '\0';
 
 	/* Move cursor to left edge */
 	snprintf(esc, sizeof(esc), "\r");
@@ -781,7 +1427,9 @@ int slash_refresh(struct slash *slash, int printtime)
 	slash->prompt_print_length = slash_prompt(slash);
 
 	if (slash->length > 0) {
-		if (slash_write(slash, slash->buffer, slash->length) < 0)
+		/* Both sides of the gap */
+		if (slash_write(slash, slash->buffer, slash->cursor) < 0 ||
+			slash_write(slash, &slash->buffer[slash->cursor + slash->gap], slash->length - slash->cursor) < 0)
 			return -1;
 	}
 
@@ -801,6 +1449,15 @@ int slash_refresh(struct slash *slash, int printtime)
 		slash_write(slash, "\033[1;30m", 7);
 		slash_write(slash, buf, strlen(buf));
 		slash_write(slash, "\033[0m", 4);
+	} else if (slash->cursor == slash->length) {
+		/* The rest of the most recent history entry starting with the line, in the same grey */
+		size_t hintlen;
+		const char *hint = slash_autosuggest(slash, &hintlen);
+		if (hint) {
+			slash_write(slash, "\033[1;30m", 7);
+			slash_write(slash, hint, hintlen);
+			slash_write(slash, "\033[0m", 4);
+		}
 	}
 
 	/* Erase to right */
@@ -821,6 +1478,7 @@ static void slash_reset(struct slash *slash)
 	slash->buffer[0] = '\0';
 	slash->length = 0;
 	slash->cursor = 0;
+	slash->gap = 0;
 }
 
 static void slash_arrow_up(struct slash *slash)
@@ -835,8 +1493,20 @@ static void slash_arrow_down(struct slash *slash)
 
 static void slash_arrow_right(struct slash *slash)
 {
-	if (slash->cursor < slash->length)
+	if (slash->cursor < slash->length) {
 		slash->cursor++;
+		return;
+	}
+
+	/* Accept the hint at the end of the line */
+	size_t hintlen;
+	const char *hint = slash_autosuggest(slash, &hintlen);
+	if (hint) {
+		memcpy(&slash->buffer[slash->length], hint, hintlen);
+		slash->length += hintlen;
+		slash->buffer[slash->length] = '\0';
+		slash->cursor = slash->length;
+	}
 }
 
 static void slash_arrow_left(struct slash *slash)
@@ -848,37 +1518,36 @@ static void slash_arrow_left(struct slash *slash)
 static void slash_delete(struct slash *slash)
 {
 	if (slash->cursor < slash->length) {
+		slash_gap_open(slash);
 		slash->length--;
-		memmove(&slash->buffer[slash->cursor],
-			&slash->buffer[slash->cursor + 1], slash->length - slash->cursor);
-		slash->buffer[slash->length] = '\0';
+		slash->gap++;
 	}
 }
 
 static void slash_backspace(struct slash *slash)
 {
-	if (slash->cursor > 0) {
+	if (slash->cursor == 0)
+		return;
+
+	if (slash->cursor == slash->length && slash->gap == 0) {
 		slash->cursor--;
 		slash->length--;
-		memmove(&slash->buffer[slash->cursor],
-			&slash->buffer[slash->cursor + 1], slash->length - slash->cursor);
 		slash->buffer[slash->length] = '\0';
+		return;
 	}
+
+	slash_gap_open(slash);
+	slash->cursor--;
+	slash->length--;
+	slash->gap++;
 }
 
 static void slash_delete_word(struct slash *slash)
 {
-	int old_cursor = slash->cursor, erased;
-
 	while (slash->cursor > 0 && slash->buffer[slash->cursor-1] == ' ')
-		slash->cursor--;
+		slash_backspace(slash);
 	while (slash->cursor > 0 && slash->buffer[slash->cursor-1] != ' ')
-		slash->cursor--;
-
-	erased = old_cursor - slash->cursor;
-
-	memmove(slash->buffer + slash->cursor, slash->buffer + old_cursor, erased);
-	slash->length -= erased;
+		slash_backspace(slash);
 }
 
 static void next_word(struct slash *slash)
@@ -929,20 +1598,161 @@ void slash_sigint(struct slash *slash, int signum) {
 	}
 }
 
-#include <stdlib.h>
+/* Next whole line of a paste, the rest of it is edited after the last one */
+static char *slash_paste_next(struct slash *slash)
+{
+	char *line = slash->paste + slash->paste_next;
+	size_t len = strcspn(line, "\n");
+	slash->paste_next += len + 1;
+
+	while (len >= slash->line_size && slash_line_grow(slash))
+		;
+	if (len >= slash->line_size) {
+		/* Skipped, running the start of the line could do something else than the whole line */
+		slash_printf(slash, "Pasted line longer than %zu characters skipped\n", slash->line_size - 1);
+		len = 0;
+	}
+
+	memcpy(slash->buffer, line, len);
+	slash->buffer[len] = '\0';
+	slash->cursor = slash->length = len;
+	slash_history_add(slash, slash->buffer);
+
+	return slash->buffer;
+}
+
+/**
+ * Bracketed paste: the terminal sends pasted text between ESC [200~ and ESC [201~, so it is
+ * inserted at once instead of key by key, and its tabs do not complete. A paste of whole lines
+ * is shown once and left in slash->paste, which slash_readline() then returns line by line
+ * without drawing them again. Returns true for such a paste.
+ */
+static bool slash_paste(struct slash *slash)
+{
+	static const char end[] = "\x1b[201~";
+	size_t size = 256, len = 0, matched = 0;
+	char *text = malloc(size);
+	bool truncated = false;
+	int c;
+
+	/* Until the end marker, noting what did not fit */
+	while (matched < sizeof(end) - 1 && (c = slash_getchar(slash)) >= 0) {
+		if (c == end[matched]) {
+			matched++;
+			continue;
+		}
+		/* Not the marker after all, unless it starts again */
+		bool again = c == end[0];
+		for (size_t i = 0; i < matched + !again; i++) {
+			char ch = i < matched ? end[i] : c;
+			if (text && len == size && size < SLASH_PASTE_MAX) {
+				char *grown = realloc(text, size * 2);
+				if (grown) {
+					text = grown;
+					size *= 2;
+				}
+			}
+			if (text && len < size)
+				text[len++] = ch;
+			else
+				truncated = true;
+		}
+		matched = again;
+	}
+
+	/* Lines cut short must not run, the whole paste is dropped */
+	if (truncated) {
+		slash_bell(slash);
+		slash_printf(slash, "\nPaste longer than %d KiB dropped\n", SLASH_PASTE_MAX / 1024);
+		free(text);
+		return false;
+	}
+	if (!text)
+		return false;
+
+	/* Lines end with a newline, tabs are spaces and other control characters are dropped */
+	size_t n = 0, last = SIZE_MAX;
+	char prev = '\0';
+	for (size_t i = 0; i < len; i++) {
+		char ch = text[i];
+		if (ch == '\n' && prev == '\r') {
+			prev = ch;
+			continue;
+		}
+		prev = ch;
+		if (ch == '\r' || ch == '\n') {
+			ch = '\n';
+			last = n;
+		} else if (ch == '\t') {
+			ch = ' ';
+		} else if ((unsigned char) ch < ' ' || ch == DEL) {
+			continue;
+		}
+		text[n++] = ch;
+	}
+
+	if (last == SIZE_MAX) {
+		slash_insert_text(slash, text, n);
+		free(text);
+		return false;
+	}
+
+	/* The line around the cursor starts the first line and ends the last one */
+	slash_gap_close(slash);
+	size_t before = slash->cursor, after = slash->length - slash->cursor;
+	char *paste = malloc(before + n + after + 1);
+	if (!paste) {
+		free(text);
+		return false;
+	}
+	memcpy(paste, slash->buffer, before);
+	memcpy(paste + before, text, n);
+	memcpy(paste + before + n, &slash->buffer[slash->cursor], after);
+	paste[before + n + after] = '\0';
+	free(text);
+
+	free(slash->paste);
+	slash->paste = paste;
+	slash->paste_next = 0;
+	slash->paste_after = after;
+
+	/* Over the line being edited, in one write after the first line */
+	size_t first = strcspn(paste, "\n");
+	slash_write(slash, "\r", 1);
+	slash_prompt(slash);
+	slash_write(slash, paste, first);
+	slash_write(slash, ESCAPE("K"), strlen(ESCAPE("K")));
+	slash_write(slash, paste + first, before + last + 1 - first);
+
+	return true;
+}
+
 char *slash_readline(struct slash *slash)
 {
 	char *ret = slash->buffer;
 	int c, esc[3];
-	bool done = false, escaped = false;
+	bool done = false, escaped = false, batch = false;
 	bool quote[3] = { false, false, false }; /* Index 0 represents double quote, index 1 represents single quote, index 2 represents a comment */
 	int mightbeminus = 0;
 
 	/* Reset buffer */
 	slash_reset(slash);
+
+	/* The lines of a paste first, then its end is edited */
+	if (slash->paste) {
+		char *rest = slash->paste + slash->paste_next;
+		if (strchr(rest, '\n'))
+			return slash_paste_next(slash);
+		slash_insert_text(slash, rest, strlen(rest));
+		slash_gap_close(slash);
+		slash->cursor -= slash_min(slash->paste_after, slash->cursor);
+		free(slash->paste);
+		slash->paste = NULL;
+	}
+
 	slash_refresh(slash, 0);
 
-	while (!done && ((c = slash_getchar(slash)) >= 0)) {
+	while (!done && ((c = slash_getkey(slash)) >= 0)) {
 		if (escaped) {
 			esc[0] = c;
 			esc[1] = slash_getchar(slash);
@@ -960,7 +1770,12 @@ char *slash_readline(struct slash *slash)
 				esc[2] = slash_getchar(slash);
 				if (esc[1] == '3' && esc[2] == '~')
 					slash_delete(slash);
-				else {
+				else if (esc[1] == '2' && esc[2] == '0') {
+					/* ESC [200~ starts a paste, ESC [201~ without one is dropped whole, ESC [20~ is F9 */
+					int last = slash_getchar(slash);
+					if ((last == '0' || last == '1') && slash_getchar(slash) == '~' && last == '0')
+						done = batch = slash_paste(slash);
+				} else {
 					if(esc[1] == '1') {
 						if(slash_getchar(slash) == '5') {
 							switch(slash_getchar(slash)) {
@@ -1001,6 +1816,10 @@ char *slash_readline(struct slash *slash)
 			}
 			escaped = false;
 		} else if (iscntrl(c)) {
+			/* Only the edits at the cursor work across the gap */
+			if (c != '\b' && c != DEL && c != CONTROL('D') && c != CONTROL('W'))
+				slash_gap_close(slash);
+
 			switch (c) {
 			case CONTROL('A'):
 				slash->cursor = 0;
@@ -1103,6 +1922,19 @@ char *slash_readline(struct slash *slash)
 			slash_refresh(slash, 0);
 	}
 
+	slash_gap_close(slash);
+
+	if (batch)
+		return slash_paste_next(slash);
+
+	/* End of input */
+	if (c < 0 && slash->length == 0)
+		ret = NULL;
+
+	/* The buffer may have grown */
+	if (ret)
+		ret = slash->buffer;
+
 	if (strlen(slash->buffer) == 0) {
 		slash_refresh(slash, 0);
 	} else {
@@ -1181,6 +2013,8 @@ struct slash *slash_create(size_t line_size, size_t history_size)
 
 	/* Allocate zero-initialized line and history buffers */
 	slash->line_size = line_size;
+	slash->line_max = line_size;
+	slash->line_owned = true;
 	slash->buffer = calloc(1, slash->line_size);
 	if (!slash->buffer) {
 		free(slash);
@@ -1202,9 +2036,15 @@ struct slash *slash_create(size_t line_size, size_t history_size)
 	slash->history_avail = slash->history_size - 1;
 	slash->complete_in_completion = true;
 
+	/* Scratch memory of the commands, slash_alloc() falls back to the heap without it */
+	slash->arena_owned = true;
+	slash_set_arena(slash, malloc(SLASH_ARENA_SIZE(line_size)), SLASH_ARENA_SIZE(line_size));
+
 	slash_list_init();
 
 	if (tcgetattr(slash->fd_read, &slash->original) < 0) {
+		free(slash->arena);
+		free(slash->history);
 		free(slash->buffer);
 		free(slash);
 		return NULL;
@@ -1224,6 +2064,9 @@ void slash_create_static(struct slash *slash, char * line_buf, size_t line_size,
 
 	/* Allocate zero-initialized line and history buffers */
 	slash->line_size = line_size;
+	slash->line_max = line_size;
+	slash->line_owned = false;
+	slash->gap = 0;
 	slash->buffer = line_buf;
 
 	slash->history_size = history_size;
@@ -1238,14 +2081,69 @@ void slash_create_static(struct slash *slash, char * line_buf, size_t line_size,
     /* Empty command list */
     slash->cmd_list = 0;
 
+	slash->record = NULL;
+
 	slash->complete_in_completion = true;
 
+	/* No arena until slash_set_arena() */
+	slash->arena_owned = false;
+	slash->arena_depth = 0;
+	slash->arena_chunks = NULL;
+	slash_set_arena(slash, NULL, 0);
+
+	slash->vars = NULL;
+	slash->fuzzy = NULL;
+	slash->completion = NULL;
+	slash->async = NULL;
+	slash->help = NULL;
+	slash->apropos = NULL;
+	slash->suggest = NULL;
+	slash->autosuggest = NULL;
+	slash->history_unique = NULL;
+	slash->paste = NULL;
+	slash->paste_mode = false;
+	slash->args = NULL;
+
+	/* No deadline until slash_set_timeout() */
+	slash->deadline_ns = 0;
+	slash->timeout_ms = 0;
+	slash->deadline_seen = false;
+	slash->deadline_outer = 0;
+	slash->deadline_default = false;
+	slash->deadline_explicit = false;
+
 	tcgetattr(slash->fd_read, &slash->original);
 }
 
-void slash_destroy(struct slash *slash)
+void slash_destroy_static(struct slash *slash)
 {
 	slash_restore_term(slash);
+#ifdef SLASH_RECORD
+	slash_record_stop(slash);
+#endif
+
+	slash_vars_free(slash);
+	slash_fuzzy_free(slash);
+	slash_completion_free(slash);
+	slash_async_free(slash);
+	slash_help_free(slash);
+	slash_apropos_free(slash);
+	slash_suggest_free(slash);
+	slash_autosuggest_free(slash);
+	slash_history_unique_free(slash);
+	free(slash->paste);
+	slash->paste = NULL;
+	slash_arena_reset(slash);
+	if (slash->arena_owned) {
+		free(slash->arena);
+		slash->arena_owned = false;
+		slash_set_arena(slash, NULL, 0);
+	}
+}
+
+void slash_destroy(struct slash *slash)
+{
+	slash_destroy_static(slash);
 
 	if (slash->buffer) {
 		free(slash->buffer);
@@ -1,8 +1,15 @@
 #include <slash/slash.h>
+#include <slash/table.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdatomic.h>
 
-#include <sys/queue.h>
+#ifdef SLASH_HAVE_SCHED_YIELD
+#include <sched.h>
+#endif
+
+#include "builtins.h"
 
 /**
  * The storage size (i.e. how closely two slash_command structs are packed in memory)
@@ -14,60 +21,419 @@ static struct slash_command command_size_set[2] __attribute__((aligned(1)));
 #define SLASH_STORAGE_SIZE ((intptr_t) &command_size_set[1] - (intptr_t) &command_size_set[0])
 #endif
 
-static SLIST_HEAD(slash_list_head_s, slash_command) slash_list_head = {0};
+/**
+ * The command registry is an immutable, name-sorted array of command pointers (a snapshot).
+ * Readers load the current snapshot and never take a lock. Writers build a new snapshot,
+ * publish it with a single atomic store and retire the old one, which is freed once all
+ * readers that could have seen it have left their read-side section (see slash_list_synchronize()).
+ */
+struct slash_list_snapshot {
+	unsigned int generation;
+	size_t count;
+	struct slash_command * const * commands;
+	/* Perfect hash of a table generated at build time, NULL for snapshots built at runtime */
+	const struct slash_table * table;
+	struct slash_list_snapshot * retired_next;
+	struct slash_command * storage[];
+};
+
+static struct slash_list_snapshot slash_list_empty = {0};
+
+/* Snapshot referring to the generated const table of a static build, see tools/slash_table_gen.py */
+static struct slash_list_snapshot slash_list_static = {0};
+static _Atomic(struct slash_list_snapshot *) slash_list_current = &slash_list_empty;
+
+/* Snapshots replaced by a writer, waiting for a grace period. Protected by slash_list_writer */
+static struct slash_list_snapshot * slash_list_retired = NULL;
+static atomic_flag slash_list_writer = ATOMIC_FLAG_INIT;
+
+/* Read-side state: two reader counters, selected by the low bit of the epoch */
+static atomic_uint slash_list_epoch = 0;
+static atomic_uint slash_list_readers[2];
+static _Thread_local unsigned int slash_list_read_depth = 0;
+static _Thread_local unsigned int slash_list_read_idx = 0;
+
+/**
+ * Grace periods, advanced by every writer without waiting, see slash_list_reclaim().
+ * A grace period flips the epoch twice and lets the counter of the previous epoch drain after
+ * each flip, then the snapshots retired before it started are freed. Protected by slash_list_writer.
+ */
+static struct slash_list_snapshot * slash_list_grace = NULL;
+static unsigned int slash_list_grace_started = 0;
+static unsigned int slash_list_grace_done = 0;
+/* Grace period a slash_list_synchronize() waits for, started even without retired snapshots */
+static unsigned int slash_list_grace_wanted = 0;
+static unsigned int slash_list_grace_flips = 0;
+static unsigned int slash_list_grace_idx = 0;
+
+void slash_list_read_lock(void) {
+
+	if (slash_list_read_depth++ > 0)
+		return;
+
+	slash_list_read_idx = atomic_load(&slash_list_epoch) & 1;
+	atomic_fetch_add(&slash_list_readers[slash_list_read_idx], 1);
+}
+
+void slash_list_read_unlock(void) {
+
+	if (--slash_list_read_depth > 0)
+		return;
+
+	atomic_fetch_sub(&slash_list_readers[slash_list_read_idx], 1);
+}
+
+static void slash_list_writer_lock(void) {
+	while (atomic_flag_test_and_set_explicit(&slash_list_writer, memory_order_acquire)) {
+#ifdef SLASH_HAVE_SCHED_YIELD
+		sched_yield();
+#endif
+	}
+}
+
+static void slash_list_writer_unlock(void) {
+	atomic_flag_clear_explicit(&slash_list_writer, memory_order_release);
+}
+
+/* Counter of the epoch before the flip, which the readers that may have seen older snapshots left */
+static unsigned int slash_list_flip(void) {
+	return atomic_fetch_add(&slash_list_epoch, 1) & 1;
+}
+
+/**
+ * Advance the grace periods as far as the readers allow, and free the snapshots of those that
+ * ended. Never waits: a reader still inside its section is checked again by the next writer,
+ * so a long running command only delays freeing memory. Must be called with the writer lock held.
+ */
+static void slash_list_reclaim(void) {
+
+	for (;;) {
+		if (slash_list_grace_started == slash_list_grace_done) {
+			if (slash_list_retired == NULL && (int) (slash_list_grace_wanted - slash_list_grace_done) <= 0)
+				return;
+
+			slash_list_grace = slash_list_retired;
+			slash_list_retired = NULL;
+			slash_list_grace_started++;
+			slash_list_grace_flips = 1;
+			slash_list_grace_idx = slash_list_flip();
+		}
+
+		if (atomic_load(&slash_list_readers[slash_list_grace_idx]) != 0)
+			return;
+
+		/* A reader may have sampled the epoch just before the first flip */
+		if (slash_list_grace_flips++ < 2) {
+			slash_list_grace_idx = slash_list_flip();
+			continue;
+		}
+
+		while (slash_list_grace) {
+			struct slash_list_snapshot * snapshot = slash_list_grace;
+			slash_list_grace = snapshot->retired_next;
+			free(snapshot);
+		}
+		slash_list_grace_done = slash_list_grace_started;
+	}
+}
+
+int slash_list_synchronize(void) {
+
+	if (slash_list_read_depth > 0)
+		return -1;
+
+	/* A grace period already started may not cover the readers of the commands just removed,
+	   wait for the next one. Writers go on meanwhile, the lock is not held while waiting */
+	slash_list_writer_lock();
+	unsigned int target = slash_list_grace_started + 1;
+	slash_list_grace_wanted = target;
+	for (;;) {
+		slash_list_reclaim();
+		bool done = (int) (slash_list_grace_done - target) >= 0;
+		slash_list_writer_unlock();
+		if (done)
+			break;
+#ifdef SLASH_HAVE_SCHED_YIELD
+		sched_yield();
+#endif
+		slash_list_writer_lock();
+	}
+
+	return 0;
+}
+
+unsigned int slash_list_generation(void) {
+	slash_list_read_lock();
+	unsigned int generation = atomic_load(&slash_list_current)->generation;
+	slash_list_read_unlock();
+	return generation;
+}
+
+/* Compare a (not zero terminated) name of length len to a command name */
+static int slash_list_name_cmp(const char * name, size_t len, const char * cmd_name) {
+	int res = strncmp(name, cmd_name, len);
+	if (res != 0)
+		return res;
+	return cmd_name[len] == '\0' ? 0 : -1;
+}
+
+static int slash_list_sort_cmp(const void * a, const void * b) {
+	const struct slash_command * const * cmd_a = a;
+	const struct slash_command * const * cmd_b = b;
+	return strcmp((*cmd_a)->name, (*cmd_b)->name);
+}
+
+uint32_t slash_table_hash(const char * name, size_t len, uint32_t seed) {
+
+	/* FNV-1a, followed by the murmur3 finalizer to spread the seed over all bits */
+	uint32_t hash = 2166136261u ^ seed;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (unsigned char) name[i];
+		hash *= 16777619u;
+	}
+
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35u;
+	hash ^= hash >> 16;
+
+	return hash;
+}
+
+static struct slash_command * slash_list_search(const struct slash_list_snapshot * snapshot, const char * name, size_t len) {
+
+	if (snapshot->table) {
+		const struct slash_table * table = snapshot->table;
+		uint32_t seed = table->seeds[slash_table_hash(name, len, 0) % table->bucket_count];
+		struct slash_command * cmd = table->commands[table->slots[slash_table_hash(name, len, seed) % table->count]];
+		return slash_list_name_cmp(name, len, cmd->name) == 0 ? cmd : NULL;
+	}
+
+	size_t lo = 0, hi = snapshot->count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int res = slash_list_name_cmp(name, len, snapshot->commands[mid]->name);
+		if (res == 0)
+			return snapshot->commands[mid];
+		if (res < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return NULL;
+}
 
 struct slash_command * slash_list_iterate(slash_list_iterator * iterator) {
 
 	/* First element */
-	if (iterator->element == NULL) {
-		iterator->element = SLIST_FIRST(&slash_list_head);
-		return iterator->element;
+	if (iterator->snapshot == NULL) {
+		iterator->snapshot = atomic_load(&slash_list_current);
+		iterator->index = 0;
+	}
+
+	if (iterator->index < iterator->snapshot->count) {
+		iterator->element = iterator->snapshot->commands[iterator->index++];
+	} else {
+		iterator->element = NULL;
 	}
 
-	iterator->element = SLIST_NEXT(iterator->element, next);
 	return iterator->element;
 }
 
+struct slash_command * slash_list_find_name_len(const char * name, size_t len) {
+
+	/* The snapshot may be freed after a writer replaced it, the command found is not */
+	slash_list_read_lock();
+	struct slash_command * cmd = slash_list_search(atomic_load(&slash_list_current), name, len);
+	slash_list_read_unlock();
+
+	return cmd;
+}
+
 struct slash_command * slash_list_find_name(const char * name) {
+	return slash_list_find_name_len(name, strlen(name));
+}
 
-	struct slash_command * found = NULL;
-	struct slash_command * cmd;
-	slash_list_iterator i = {0};
-	while ((cmd = slash_list_iterate(&i)) != NULL) {
+/* A command leaves the list, a command added later at the same address is another one */
+static void slash_list_retire_command(const struct slash_command * cmd) {
+#if defined(SLASH_STATS) || defined(SLASH_TRACE)
+	slash_command_id_drop(cmd);
+#else
+	(void) cmd;
+#endif
+}
 
-		if (strcmp(cmd->name, name) == 0) {
-			found = cmd;
-			break;
+/**
+ * Publish a new snapshot consisting of the current commands minus the ones named in `remove`,
+ * plus the ones in `add` (replacing commands with the same name). All changes become visible
+ * to readers at once.
+ * @return number of commands in `add` which replaced an existing command, or -1 on error
+ */
+static int slash_list_update(struct slash_command * const * add, size_t add_count,
+							 const struct slash_command * const * remove, size_t remove_count) {
+
+	slash_list_writer_lock();
+
+	struct slash_list_snapshot * prev = atomic_load(&slash_list_current);
+	struct slash_list_snapshot * next = malloc(sizeof(*next) + (prev->count + add_count) * sizeof(next->storage[0]));
+	struct slash_command ** batch = malloc((add_count ? add_count : 1) * sizeof(*batch));
+	if (next == NULL || batch == NULL) {
+		free(next);
+		free(batch);
+		slash_list_writer_unlock();
+		return -1;
+	}
+
+	/* Sort the batch once, keeping the last of any duplicate names */
+	if (add_count > 0)
+		memcpy(batch, add, add_count * sizeof(*batch));
+	qsort(batch, add_count, sizeof(*batch), slash_list_sort_cmp);
+	size_t batch_count = 0;
+	for (size_t i = 0; i < add_count; i++) {
+		if (batch_count > 0 && strcmp(batch[batch_count - 1]->name, batch[i]->name) == 0) {
+			batch[batch_count - 1] = batch[i];
+		} else {
+			batch[batch_count++] = batch[i];
 		}
+	}
 
-		continue;
+	/* Merge with the current commands */
+	int replaced = 0;
+	size_t i = 0, j = 0, count = 0;
+	while (i < prev->count || j < batch_count) {
+		int res;
+		if (i == prev->count) {
+			res = 1;
+		} else if (j == batch_count) {
+			res = -1;
+		} else {
+			res = strcmp(prev->commands[i]->name, batch[j]->name);
+		}
+
+		if (res < 0) {
+			next->storage[count++] = prev->commands[i++];
+		} else {
+			if (res == 0) {
+				slash_list_retire_command(prev->commands[i]);
+				replaced++;
+				i++;
+			}
+			next->storage[count++] = batch[j++];
+		}
 	}
+	free(batch);
+	next->commands = next->storage;
+	next->table = NULL;
+	next->count = count;
 
-	return found;
+	for (size_t r = 0; r < remove_count; r++) {
+		next->count = count;
+		struct slash_command * cmd = slash_list_search(next, remove[r]->name, strlen(remove[r]->name));
+		if (cmd == NULL)
+			continue;
+		for (size_t k = 0; k < count; k++) {
+			if (next->storage[k] == cmd) {
+				slash_list_retire_command(cmd);
+				memmove(&next->storage[k], &next->storage[k + 1], (count - k - 1) * sizeof(next->storage[0]));
+				count--;
+				break;
+			}
+		}
+	}
+	next->count = count;
+	next->generation = prev->generation + 1;
+	next->retired_next = NULL;
+
+	atomic_store(&slash_list_current, next);
+
+	if (prev != &slash_list_empty && prev != &slash_list_static) {
+		prev->retired_next = slash_list_retired;
+		slash_list_retired = prev;
+	}
+	slash_list_reclaim();
+
+	slash_list_writer_unlock();
+
+	return replaced;
 }
 
 int slash_list_add(struct slash_command * item) {
+	return slash_list_update(&item, 1, NULL, 0);
+}
 
-	struct slash_command * cmd;
-	if ((cmd = slash_list_find_name(item->name)) != NULL) {
-		SLIST_REMOVE(&slash_list_head, cmd, slash_command, next);
-		SLIST_INSERT_HEAD(&slash_list_head, item, next);
-		return 1;
-	} else {
-		SLIST_INSERT_HEAD(&slash_list_head, item, next);
-		return 0;
-	}
+int slash_list_add_batch(struct slash_command * const * items, size_t count) {
+	return slash_list_update(items, count, NULL, 0);
 }
 
 int slash_list_remove(const struct slash_command * item) {
 
-	struct slash_command * cmd;
-	if ((cmd = slash_list_find_name(item->name)) != NULL) {  // Check that the command exists in the global list
-		SLIST_REMOVE(&slash_list_head, cmd, slash_command, next);
+	/* Check that the command exists in the global list */
+	slash_list_read_lock();
+	struct slash_command * cmd = slash_list_find_name(item->name);
+	slash_list_read_unlock();
+	if (cmd == NULL)
+		return -1;
+
+	if (slash_list_update(NULL, 0, &item, 1) < 0)
+		return -1;
+
+	return 0;
+}
+
+struct slash_command * slash_list_section_next(struct slash_command * cmd) {
+	return (struct slash_command *)(intptr_t)((char *)cmd + SLASH_STORAGE_SIZE);
+}
+
+/* Collect the commands of a section into a temporary array */
+static size_t slash_list_section_collect(struct slash_command * start, struct slash_command * stop, struct slash_command *** items) {
+
+	size_t count = 0;
+	for (struct slash_command * cmd = start; cmd < stop; cmd = slash_list_section_next(cmd))
+		count++;
+
+	*items = malloc((count ? count : 1) * sizeof(**items));
+	if (*items == NULL)
 		return 0;
-	} else {
+
+	size_t i = 0;
+	for (struct slash_command * cmd = start; cmd < stop; cmd = slash_list_section_next(cmd))
+		(*items)[i++] = cmd;
+
+	return count;
+}
+
+int slash_list_add_section(struct slash_command * start, struct slash_command * stop) {
+
+	if (start == NULL || stop == NULL || start >= stop)
+		return 0;
+
+	struct slash_command ** items;
+	size_t count = slash_list_section_collect(start, stop, &items);
+	if (items == NULL)
 		return -1;
-	}
+
+	int res = slash_list_add_batch(items, count);
+	free(items);
+
+	return res < 0 ? -1 : (int) count;
+}
+
+int slash_list_remove_section(struct slash_command * start, struct slash_command * stop) {
+
+	if (start == NULL || stop == NULL || start >= stop)
+		return 0;
+
+	struct slash_command ** items;
+	size_t count = slash_list_section_collect(start, stop, &items);
+	if (items == NULL)
+		return -1;
+
+	int res = slash_list_update(NULL, 0, (const struct slash_command * const *) items, count);
+	free(items);
+
+	return res < 0 ? -1 : 0;
 }
 
 int slash_list_init() {
@@ -79,14 +445,25 @@ int slash_list_init() {
 	__attribute__((weak)) extern struct slash_command __start_slash;
 	__attribute__((weak)) extern struct slash_command __stop_slash;
 
-	slash_list_iterator iterator = {0};
-	iterator.element = &__start_slash;
+	/* A static build with a generated table needs no registration at all */
+	if (&slash_static_table != NULL && slash_static_table.count > 0) {
+		struct slash_list_snapshot * expected = &slash_list_empty;
+		if (atomic_load(&slash_list_current) == &slash_list_static)
+			return 0;
 
-	while (iterator.element != &__stop_slash) {
-		slash_list_add(iterator.element);
+		slash_list_static.generation = 1;
+		slash_list_static.count = slash_static_table.count;
+		slash_list_static.commands = slash_static_table.commands;
+		slash_list_static.table = &slash_static_table;
+		if (atomic_compare_exchange_strong(&slash_list_current, &expected, &slash_list_static))
+			return 0;
 
-		iterator.element = (struct slash_command *)(intptr_t)((char *)iterator.element + SLASH_STORAGE_SIZE);
+		/* Commands were added before, merge the table with those */
+		return slash_list_add_batch(slash_static_table.commands, slash_static_table.count) < 0 ? -1 : 0;
 	}
 
+	if (slash_list_add_section(&__start_slash, &__stop_slash) < 0)
+		return -1;
+
 	return 0;
 }
@@ -0,0 +1,127 @@
+#include <slash/stats.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "builtins.h"
+
+static _Atomic(struct slash_stats_header *) slash_stats;
+static char slash_stats_name[64];
+
+int slash_stats_open(const char * name) {
+
+	if (atomic_load(&slash_stats) != NULL || strlen(name) >= sizeof(slash_stats_name))
+		return -1;
+
+	size_t size = SLASH_STATS_SIZE(SLASH_COMMAND_ID_MAX);
+	int fd = shm_open(name, O_CREAT | O_TRUNC | O_RDWR, 0644);
+	if (fd < 0) {
+		perror("shm_open");
+		return -1;
+	}
+
+	if (ftruncate(fd, size) < 0) {
+		perror("ftruncate");
+		close(fd);
+		shm_unlink(name);
+		return -1;
+	}
+
+	struct slash_stats_header * header = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (header == MAP_FAILED) {
+		perror("mmap");
+		shm_unlink(name);
+		return -1;
+	}
+
+	header->header_size = sizeof(struct slash_stats_header);
+	header->entry_size = sizeof(struct slash_stats_entry);
+	header->max_entries = SLASH_COMMAND_ID_MAX;
+	header->bucket_count = SLASH_STATS_BUCKETS;
+	header->sub_bits = SLASH_STATS_SUB_BITS;
+	header->pid = getpid();
+	atomic_init(&header->entry_count, 0);
+	atomic_init(&header->overflow, 0);
+	header->version = SLASH_STATS_VERSION;
+	/* Readers check the magic last */
+	atomic_thread_fence(memory_order_release);
+	header->magic = SLASH_STATS_MAGIC;
+
+	strcpy(slash_stats_name, name);
+	atomic_store_explicit(&slash_stats, header, memory_order_release);
+
+	return 0;
+}
+
+void slash_stats_close(void) {
+
+	struct slash_stats_header * header = atomic_exchange(&slash_stats, NULL);
+	if (header == NULL)
+		return;
+
+	shm_unlink(slash_stats_name);
+
+	/* Recorders inside their read-side section may still write to the segment. Closed by a
+	   command, which cannot wait for itself, the segment stays mapped until the process exits */
+	if (slash_list_synchronize() == 0)
+		munmap(header, SLASH_STATS_SIZE(SLASH_COMMAND_ID_MAX));
+}
+
+/* Entries are indexed by command id, see command_id.c */
+static struct slash_stats_entry * slash_stats_entry(struct slash_stats_header * header, const struct slash_command * command) {
+
+	int id = slash_command_id(command);
+	if (id < 0 || (uint32_t) id >= header->max_entries)
+		return NULL;
+
+	struct slash_stats_entry * entry = (struct slash_stats_entry *) ((char *) header + header->header_size) + id;
+	if (atomic_load_explicit(&entry->ready, memory_order_acquire) == 1)
+		return entry;
+
+	/* First use of the entry: name it and make it visible to readers */
+	uint32_t ready = 0;
+	if (atomic_compare_exchange_strong_explicit(&entry->ready, &ready, 2, memory_order_relaxed, memory_order_relaxed)) {
+		strncpy(entry->name, command->name, sizeof(entry->name) - 1);
+		atomic_store_explicit(&entry->ready, 1, memory_order_release);
+
+		uint32_t count = atomic_load_explicit(&header->entry_count, memory_order_relaxed);
+		while (count < (uint32_t) id + 1 &&
+			   !atomic_compare_exchange_weak_explicit(&header->entry_count, &count, id + 1,
+													 memory_order_release, memory_order_relaxed))
+			;
+	}
+
+	return entry;
+}
+
+static void slash_stats_add(struct slash_stats_header * header, const struct slash_command * command, uint64_t ns) {
+
+	struct slash_stats_entry * entry = slash_stats_entry(header, command);
+	if (entry == NULL) {
+		atomic_fetch_add_explicit(&header->overflow, 1, memory_order_relaxed);
+		return;
+	}
+
+	atomic_fetch_add_explicit(&entry->count, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&entry->total_ns, ns, memory_order_relaxed);
+	atomic_fetch_add_explicit(&entry->buckets[slash_stats_bucket(ns)], 1, memory_order_relaxed);
+
+	uint64_t max = atomic_load_explicit(&entry->max_ns, memory_order_relaxed);
+	while (ns > max && !atomic_compare_exchange_weak_explicit(&entry->max_ns, &max, ns,
+															   memory_order_relaxed, memory_order_relaxed))
+		;
+}
+
+void slash_stats_record(const struct slash_command * command, uint64_t ns) {
+
+	/* The segment is not unmapped before the section is left, see slash_stats_close() */
+	slash_list_read_lock();
+	struct slash_stats_header * header = atomic_load_explicit(&slash_stats, memory_order_acquire);
+	if (header != NULL)
+		slash_stats_add(header, command, ns);
+	slash_list_read_unlock();
+}
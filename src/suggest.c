@@ -0,0 +1,351 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <slash/slash.h>
+#include <slash/table.h>
+
+#include "builtins.h"
+
+#define SLASH_SUGGEST_DISTANCE	2	/* Largest number of typos corrected */
+#define SLASH_SUGGEST_MAX		3	/* Number of commands suggested */
+#define SLASH_SUGGEST_NAME_MAX	64	/* Longer names are not suggested */
+
+#define SLASH_SUGGEST_NONE		UINT32_MAX
+
+/**
+ * BK-tree of the command names: the children of a node are labelled with their Levenshtein
+ * distance to it, so by the triangle inequality a search within distance k of a word only
+ * descends into the children labelled d - k to d + k, d being the distance of the word to the
+ * node. A swap of two letters costs 2 there, the matches are ranked by the distance counting it
+ * as 1, which is not a metric and cannot prune the tree.
+ *
+ * The nodes keep a copy of their name, commands of an unloaded APM are only marked gone, and
+ * come back to life when registered again.
+ */
+struct slash_suggest_node {
+	char *name;
+	uint32_t child;
+	uint32_t sibling;
+	uint8_t distance;
+	uint8_t length;
+	bool alive;
+	unsigned int seen;
+};
+
+/* A word to measure names against, with the positions of each character in it as bits */
+struct slash_suggest_word {
+	const char *word;
+	size_t length;
+	uint64_t positions[256];
+};
+
+struct slash_suggest {
+	bool valid;
+	unsigned int generation;
+	unsigned int epoch;
+	/* Words in the longest name */
+	unsigned int words;
+
+	struct slash_suggest_node *nodes;
+	unsigned int count;
+	unsigned int size;
+
+	/* Node of each name, open addressing with linear probing */
+	uint32_t *slots;
+	unsigned int slot_size;
+
+	/* The word being inserted or searched for */
+	struct slash_suggest_word word;
+};
+
+static void slash_suggest_word_init(struct slash_suggest_word *w, const char *word, size_t len)
+{
+	w->word = word;
+	w->length = len;
+	for (size_t i = 0; i < len; i++)
+		w->positions[(unsigned char) word[i]] |= 1ull << i;
+}
+
+static void slash_suggest_word_reset(struct slash_suggest_word *w)
+{
+	for (size_t i = 0; i < w->length; i++)
+		w->positions[(unsigned char) w->word[i]] = 0;
+}
+
+/**
+ * Levenshtein distance (insertions, deletions and substitutions) of a name to the word, with the
+ * bit-parallel algorithm of Myers: one column of the distance matrix is a word of bits, updated in
+ * a few operations for each character. With swaps, the extension of Hyyro also counts the
+ * transposition of two adjacent characters as one edit (optimal string alignment distance).
+ */
+static unsigned int slash_suggest_distance(const struct slash_suggest_word *w, const char *name, size_t len, bool swaps)
+{
+	if (w->length == 0)
+		return len;
+
+	uint64_t last = 1ull << (w->length - 1);
+	uint64_t vp = ~0ull, vn = 0, d0 = 0, pm_prev = 0;
+	unsigned int distance = w->length;
+
+	for (size_t j = 0; j < len; j++) {
+		uint64_t pm = w->positions[(unsigned char) name[j]];
+		uint64_t tr = swaps ? ((~d0 & pm) << 1) & pm_prev : 0;
+		d0 = (((pm & vp) + vp) ^ vp) | pm | vn | tr;
+		uint64_t hp = vn | ~(d0 | vp);
+		uint64_t hn = d0 & vp;
+		if (hp & last)
+			distance++;
+		else if (hn & last)
+			distance--;
+		uint64_t x = (hp << 1) | 1;
+		vn = x & d0;
+		vp = (hn << 1) | ~(x | d0);
+		pm_prev = pm;
+	}
+
+	return distance;
+}
+
+static uint32_t *slash_suggest_slot(struct slash_suggest *index, const char *name, size_t len)
+{
+	unsigned int mask = index->slot_size - 1;
+	unsigned int i = slash_table_hash(name, len, 0) & mask;
+
+	while (index->slots[i] != SLASH_SUGGEST_NONE) {
+		const struct slash_suggest_node *node = &index->nodes[index->slots[i]];
+		if (node->length == len && memcmp(node->name, name, len) == 0)
+			break;
+		i = (i + 1) & mask;
+	}
+
+	return &index->slots[i];
+}
+
+static int slash_suggest_grow(struct slash_suggest *index)
+{
+	if (index->count == index->size) {
+		unsigned int size = index->size ? index->size * 2 : 256;
+		struct slash_suggest_node *nodes = realloc(index->nodes, size * sizeof(*nodes));
+		if (!nodes)
+			return -1;
+		index->nodes = nodes;
+		index->size = size;
+	}
+
+	/* Keep the load factor of the names below 1/2 */
+	if (index->slots && (index->count + 1) * 2 < index->slot_size)
+		return 0;
+
+	unsigned int size = index->slot_size ? index->slot_size * 2 : 512;
+	uint32_t *slots = malloc(size * sizeof(*slots));
+	if (!slots)
+		return -1;
+	memset(slots, 0xff, size * sizeof(*slots));
+
+	free(index->slots);
+	index->slots = slots;
+	index->slot_size = size;
+	for (uint32_t n = 0; n < index->count; n++)
+		*slash_suggest_slot(index, index->nodes[n].name, index->nodes[n].length) = n;
+
+	return 0;
+}
+
+static int slash_suggest_insert(struct slash_suggest *index, const char *name, size_t len)
+{
+	if (slash_suggest_grow(index) < 0)
+		return -1;
+
+	uint32_t n = index->count;
+	struct slash_suggest_node *node = &index->nodes[n];
+	node->name = strndup(name, len);
+	if (!node->name)
+		return -1;
+	node->child = SLASH_SUGGEST_NONE;
+	node->sibling = SLASH_SUGGEST_NONE;
+	node->distance = 0;
+	node->length = len;
+	node->alive = true;
+	node->seen = index->epoch;
+	index->count++;
+	*slash_suggest_slot(index, name, len) = n;
+
+	/* Below the first node at the same distance as the parent, down from the root */
+	struct slash_suggest_word *w = &index->word;
+	slash_suggest_word_init(w, name, len);
+	uint32_t parent = 0;
+	while (n > 0) {
+		struct slash_suggest_node *p = &index->nodes[parent];
+		unsigned int distance = slash_suggest_distance(w, p->name, p->length, false);
+		uint32_t child = p->child;
+		while (child != SLASH_SUGGEST_NONE && index->nodes[child].distance != distance)
+			child = index->nodes[child].sibling;
+		if (child == SLASH_SUGGEST_NONE) {
+			node->distance = distance;
+			node->sibling = p->child;
+			p->child = n;
+			break;
+		}
+		parent = child;
+	}
+	slash_suggest_word_reset(w);
+
+	return 0;
+}
+
+static void slash_suggest_clear(struct slash_suggest *index)
+{
+	for (unsigned int n = 0; n < index->count; n++)
+		free(index->nodes[n].name);
+	free(index->nodes);
+	free(index->slots);
+	memset(index, 0, sizeof(*index));
+}
+
+/* Bring the tree up to the current command list, called with it read locked */
+static int slash_suggest_update(struct slash_suggest *index)
+{
+	unsigned int generation = slash_list_generation();
+	if (index->valid && index->generation == generation)
+		return 0;
+
+	index->valid = false;
+	index->epoch++;
+
+	struct slash_command *cmd;
+	slash_list_iterator i = {0};
+	while ((cmd = slash_list_iterate(&i)) != NULL) {
+		size_t len = strlen(cmd->name);
+		if (len > SLASH_SUGGEST_NAME_MAX)
+			continue;
+
+		uint32_t n = index->slots ? *slash_suggest_slot(index, cmd->name, len) : SLASH_SUGGEST_NONE;
+		if (n != SLASH_SUGGEST_NONE) {
+			index->nodes[n].alive = true;
+			index->nodes[n].seen = index->epoch;
+			continue;
+		}
+		if (slash_suggest_insert(index, cmd->name, len) < 0) {
+			slash_suggest_clear(index);
+			return -1;
+		}
+
+		unsigned int words = 1;
+		for (const char *c = cmd->name; *c; c++)
+			words += *c == ' ';
+		index->words = slash_max(index->words, words);
+	}
+
+	for (uint32_t n = 0; n < index->count; n++) {
+		if (index->nodes[n].seen != index->epoch)
+			index->nodes[n].alive = false;
+	}
+
+	index->generation = generation;
+	index->valid = true;
+
+	return 0;
+}
+
+struct slash_suggest_match {
+	uint32_t node;
+	unsigned int distance;
+};
+
+/* Keep the closest matches, by distance and then by name */
+static void slash_suggest_keep(struct slash_suggest *index, struct slash_suggest_match *best, unsigned int *found,
+							   uint32_t node, unsigned int distance)
+{
+	for (unsigned int i = 0; i < *found; i++) {
+		if (best[i].node == node)
+			return;
+	}
+
+	unsigned int pos = *found;
+	while (pos > 0 && (best[pos - 1].distance > distance || (best[pos - 1].distance == distance &&
+			strcmp(index->nodes[best[pos - 1].node].name, index->nodes[node].name) > 0)))
+		pos--;
+	if (pos == SLASH_SUGGEST_MAX)
+		return;
+
+	unsigned int last = slash_min(*found, (unsigned int) SLASH_SUGGEST_MAX - 1);
+	memmove(&best[pos + 1], &best[pos], (last - pos) * sizeof(*best));
+	best[pos].node = node;
+	best[pos].distance = distance;
+	if (*found < SLASH_SUGGEST_MAX)
+		(*found)++;
+}
+
+static void slash_suggest_search(struct slash_suggest *index, uint32_t node, unsigned int max,
+								 struct slash_suggest_match *best, unsigned int *found)
+{
+	/* A name within max edits, swaps included, is within twice that without swaps */
+	const struct slash_suggest_node *n = &index->nodes[node];
+	unsigned int radius = 2 * max;
+	unsigned int distance = slash_suggest_distance(&index->word, n->name, n->length, false);
+	if (distance <= radius && n->alive) {
+		unsigned int swapped = distance > 1 ? slash_suggest_distance(&index->word, n->name, n->length, true) : distance;
+		if (swapped <= max)
+			slash_suggest_keep(index, best, found, node, swapped);
+	}
+
+	for (uint32_t child = n->child; child != SLASH_SUGGEST_NONE; child = index->nodes[child].sibling) {
+		unsigned int d = index->nodes[child].distance;
+		if (d + radius >= distance && d <= distance + radius)
+			slash_suggest_search(index, child, max, best, found);
+	}
+}
+
+void slash_suggest(struct slash *slash, const char *line)
+{
+	struct slash_suggest *index = slash->suggest;
+	if (!index) {
+		index = calloc(1, sizeof(*index));
+		if (!index)
+			return;
+		slash->suggest = index;
+	}
+
+	slash_list_read_lock();
+	int ret = slash_suggest_update(index);
+	slash_list_read_unlock();
+	if (ret < 0 || index->count == 0)
+		return;
+
+	/* The command may be any number of the first words of the line */
+	struct slash_suggest_match best[SLASH_SUGGEST_MAX];
+	unsigned int found = 0;
+	const char *start = line + strspn(line, " ");
+	const char *end = start;
+	for (unsigned int words = 0; words < index->words && *end; words++) {
+		end += strcspn(end, " ");
+		size_t len = end - start;
+		if (len > SLASH_SUGGEST_NAME_MAX)
+			break;
+		/* Fewer typos in short names, or anything would do */
+		unsigned int max = len <= 4 ? 1 : SLASH_SUGGEST_DISTANCE;
+		slash_suggest_word_init(&index->word, start, len);
+		slash_suggest_search(index, 0, max, best, &found);
+		slash_suggest_word_reset(&index->word);
+		end += strspn(end, " ");
+	}
+
+	if (found == 0)
+		return;
+
+	slash_printf(slash, "Did you mean: ");
+	for (unsigned int i = 0; i < found; i++)
+		slash_printf(slash, "%s%s", i > 0 ? ", " : "", index->nodes[best[i].node].name);
+	slash_printf(slash, "\n");
+}
+
+void slash_suggest_free(struct slash *slash)
+{
+	if (!slash->suggest)
+		return;
+
+	slash_suggest_clear(slash->suggest);
+	free(slash->suggest);
+	slash->suggest = NULL;
+}
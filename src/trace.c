@@ -0,0 +1,212 @@
+#include <slash/trace.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "builtins.h"
+
+/* Ring slots are written like a seqlock: seq is 0 while the record is being written,
+   then the position of the record + 1 */
+struct slash_trace_slot {
+	_Atomic uint64_t seq;
+	struct slash_trace_record record;
+};
+
+static _Atomic(struct slash_trace_slot *) slash_trace_ring;
+static size_t slash_trace_mask;
+static _Atomic uint64_t slash_trace_head;
+
+static char slash_trace_crash_path[256];
+
+int slash_trace_start(size_t records) {
+
+	if (atomic_load(&slash_trace_ring) != NULL || records == 0)
+		return -1;
+
+	size_t size = 1;
+	while (size < records)
+		size <<= 1;
+
+	struct slash_trace_slot * ring = calloc(size, sizeof(*ring));
+	if (ring == NULL)
+		return -1;
+
+	slash_trace_mask = size - 1;
+	atomic_store(&slash_trace_head, 0);
+	atomic_store(&slash_trace_ring, ring);
+
+	return 0;
+}
+
+void slash_trace_stop(void) {
+	free(atomic_exchange(&slash_trace_ring, NULL));
+}
+
+uint64_t slash_trace_begin(const struct slash_command * command, uint64_t timestamp_ns, uint32_t args_digest) {
+
+	struct slash_trace_slot * ring = atomic_load_explicit(&slash_trace_ring, memory_order_acquire);
+	if (ring == NULL)
+		return 0;
+
+	int id = slash_command_id(command);
+	uint64_t pos = atomic_fetch_add_explicit(&slash_trace_head, 1, memory_order_relaxed);
+	struct slash_trace_slot * slot = &ring[pos & slash_trace_mask];
+
+	atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	slot->record.timestamp_ns = timestamp_ns;
+	slot->record.duration_ns = 0;
+	slot->record.ret = 0;
+	slot->record.command = id < 0 ? UINT16_MAX : id;
+	slot->record.flags = SLASH_TRACE_RUNNING;
+	slot->record.args_digest = args_digest;
+	atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+	return pos + 1;
+}
+
+void slash_trace_end(uint64_t handle, uint64_t duration_ns, int ret) {
+
+	/* The ring may have been stopped, and started again, while the command was running */
+	struct slash_trace_slot * ring = atomic_load_explicit(&slash_trace_ring, memory_order_acquire);
+	if (ring == NULL || handle == 0 || handle > atomic_load_explicit(&slash_trace_head, memory_order_relaxed))
+		return;
+
+	/* Only while the slot still holds the record, it is invalid while being completed */
+	struct slash_trace_slot * slot = &ring[(handle - 1) & slash_trace_mask];
+	uint64_t seq = handle;
+	if (!atomic_compare_exchange_strong_explicit(&slot->seq, &seq, 0, memory_order_relaxed, memory_order_relaxed))
+		return;
+
+	atomic_thread_fence(memory_order_release);
+	slot->record.duration_ns = duration_ns;
+	slot->record.ret = ret;
+	slot->record.flags = 0;
+	atomic_store_explicit(&slot->seq, handle, memory_order_release);
+}
+
+/* write() everything, only async-signal-safe calls from here on */
+static int slash_trace_write(int fd, const void * buf, size_t len) {
+
+	const char * p = buf;
+	while (len > 0) {
+		ssize_t n = write(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+int slash_trace_dump_fd(int fd) {
+
+	struct slash_trace_slot * ring = atomic_load_explicit(&slash_trace_ring, memory_order_acquire);
+	if (ring == NULL)
+		return -1;
+
+	uint64_t head = atomic_load_explicit(&slash_trace_head, memory_order_acquire);
+	uint64_t size = slash_trace_mask + 1;
+
+	struct timespec mono, real;
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	clock_gettime(CLOCK_REALTIME, &real);
+
+	struct slash_trace_file_header header = {
+		.magic = SLASH_TRACE_MAGIC,
+		.version = SLASH_TRACE_VERSION,
+		.header_size = sizeof(header),
+		.record_size = sizeof(struct slash_trace_record),
+		.name_size = SLASH_COMMAND_ID_NAME_SIZE,
+		.name_count = slash_command_id_count(),
+		.realtime_offset_ns = (int64_t) (real.tv_sec - mono.tv_sec) * 1000000000 + real.tv_nsec - mono.tv_nsec,
+		.total = head,
+	};
+	if (slash_trace_write(fd, &header, sizeof(header)) < 0)
+		return -1;
+
+	for (unsigned int id = 0; id < header.name_count; id++) {
+		if (slash_trace_write(fd, slash_command_id_name(id), SLASH_COMMAND_ID_NAME_SIZE) < 0)
+			return -1;
+	}
+
+	/* Copy the records in batches, skipping the ones being overwritten meanwhile */
+	struct slash_trace_record batch[64];
+	size_t count = 0;
+	int written = 0;
+	for (uint64_t pos = head > size ? head - size : 0; pos < head; pos++) {
+		struct slash_trace_slot * slot = &ring[pos & slash_trace_mask];
+		if (atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + 1)
+			continue;
+		batch[count] = slot->record;
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != pos + 1)
+			continue;
+
+		if (++count == sizeof(batch) / sizeof(batch[0])) {
+			if (slash_trace_write(fd, batch, sizeof(batch)) < 0)
+				return -1;
+			written += count;
+			count = 0;
+		}
+	}
+	if (slash_trace_write(fd, batch, count * sizeof(batch[0])) < 0)
+		return -1;
+
+	return written + count;
+}
+
+int slash_trace_dump(const char * path) {
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return -1;
+
+	int res = slash_trace_dump_fd(fd);
+	if (close(fd) < 0)
+		res = -1;
+
+	return res;
+}
+
+static void slash_trace_crash_handler(int signum) {
+
+	int fd = open(slash_trace_crash_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd >= 0) {
+		slash_trace_dump_fd(fd);
+		close(fd);
+	}
+
+	/* The handler was reset to the default, crash for real */
+	raise(signum);
+}
+
+int slash_trace_dump_on_crash(const char * path) {
+
+	if (strlen(path) >= sizeof(slash_trace_crash_path))
+		return -1;
+	strcpy(slash_trace_crash_path, path);
+
+	struct sigaction sa = {
+		.sa_handler = slash_trace_crash_handler,
+		.sa_flags = SA_RESETHAND,
+	};
+	sigemptyset(&sa.sa_mask);
+
+	const int signals[] = {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT};
+	for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); i++) {
+		if (sigaction(signals[i], &sa, NULL) < 0)
+			return -1;
+	}
+
+	return 0;
+}
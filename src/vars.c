@@ -0,0 +1,316 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <slash/slash.h>
+#include <slash/table.h>
+
+#include "builtins.h"
+
+/* Open addressing with linear probing, name and value share one allocation */
+struct slash_var {
+	uint32_t hash;
+	char *name;
+	char *value;
+};
+
+struct slash_vars {
+	unsigned int size;
+	unsigned int count;
+	struct slash_var *slots;
+};
+
+static bool slash_var_name_valid(const char *name, size_t len)
+{
+	if (len == 0 || len > SLASH_VAR_NAME_MAX || isdigit((unsigned char) name[0]))
+		return false;
+
+	for (size_t i = 0; i < len; i++) {
+		if (!isalnum((unsigned char) name[i]) && name[i] != '_')
+			return false;
+	}
+
+	return true;
+}
+
+static struct slash_var *slash_var_find(struct slash_vars *vars, const char *name, size_t len, uint32_t hash)
+{
+	unsigned int mask = vars->size - 1;
+
+	for (unsigned int i = hash & mask; vars->slots[i].name; i = (i + 1) & mask) {
+		struct slash_var *var = &vars->slots[i];
+		if (var->hash == hash && strncmp(var->name, name, len) == 0 && var->name[len] == '\0')
+			return var;
+	}
+
+	return NULL;
+}
+
+static struct slash_var *slash_var_slot(struct slash_vars *vars, uint32_t hash)
+{
+	unsigned int mask = vars->size - 1;
+	unsigned int i = hash & mask;
+
+	while (vars->slots[i].name)
+		i = (i + 1) & mask;
+
+	return &vars->slots[i];
+}
+
+static int slash_vars_grow(struct slash *slash)
+{
+	struct slash_vars *vars = slash->vars;
+
+	if (!vars) {
+		vars = calloc(1, sizeof(*vars));
+		if (!vars)
+			return SLASH_ENOMEM;
+		slash->vars = vars;
+	}
+
+	/* Keep the load factor below 3/4 */
+	if (vars->slots && (vars->count + 1) * 4 < vars->size * 3)
+		return SLASH_SUCCESS;
+
+	unsigned int size = vars->size ? vars->size * 2 : 16;
+	struct slash_var *slots = calloc(size, sizeof(*slots));
+	if (!slots)
+		return SLASH_ENOMEM;
+
+	struct slash_vars grown = {
+		.size = size,
+		.count = vars->count,
+		.slots = slots,
+	};
+	for (unsigned int i = 0; i < vars->size; i++) {
+		if (vars->slots[i].name)
+			*slash_var_slot(&grown, vars->slots[i].hash) = vars->slots[i];
+	}
+
+	free(vars->slots);
+	*vars = grown;
+
+	return SLASH_SUCCESS;
+}
+
+int slash_var_set(struct slash *slash, const char *name, const char *value)
+{
+	size_t name_len = strlen(name);
+	if (!slash_var_name_valid(name, name_len))
+		return SLASH_EINVAL;
+
+	if (slash_vars_grow(slash) < 0)
+		return SLASH_ENOMEM;
+
+	size_t value_len = strlen(value);
+	char *data = malloc(name_len + value_len + 2);
+	if (!data)
+		return SLASH_ENOMEM;
+	memcpy(data, name, name_len + 1);
+	memcpy(data + name_len + 1, value, value_len + 1);
+
+	uint32_t hash = slash_table_hash(name, name_len, 0);
+	struct slash_var *var = slash_var_find(slash->vars, name, name_len, hash);
+	if (var) {
+		free(var->name);
+	} else {
+		var = slash_var_slot(slash->vars, hash);
+		var->hash = hash;
+		slash->vars->count++;
+	}
+	var->name = data;
+	var->value = data + name_len + 1;
+
+	return SLASH_SUCCESS;
+}
+
+int slash_var_unset(struct slash *slash, const char *name)
+{
+	struct slash_vars *vars = slash->vars;
+	size_t len = strlen(name);
+	uint32_t hash = slash_table_hash(name, len, 0);
+
+	struct slash_var *var = vars ? slash_var_find(vars, name, len, hash) : NULL;
+	if (!var)
+		return SLASH_ENOENT;
+
+	free(var->name);
+	vars->count--;
+
+	/* Shift the following entries of the probe sequence back into the hole */
+	unsigned int mask = vars->size - 1;
+	unsigned int hole = var - vars->slots;
+	for (unsigned int i = (hole + 1) & mask; vars->slots[i].name; i = (i + 1) & mask) {
+		unsigned int home = vars->slots[i].hash & mask;
+		if (((i - home) & mask) >= ((i - hole) & mask)) {
+			vars->slots[hole] = vars->slots[i];
+			hole = i;
+		}
+	}
+	vars->slots[hole].name = NULL;
+
+	return SLASH_SUCCESS;
+}
+
+static const char *slash_var_lookup(struct slash *slash, const char *name, size_t len)
+{
+	if (slash->vars) {
+		struct slash_var *var = slash_var_find(slash->vars, name, len, slash_table_hash(name, len, 0));
+		if (var)
+			return var->value;
+	}
+
+	/* Then the environment, where the run hooks put __FILE__ and __FILE_DIR__ */
+	char env_name[SLASH_VAR_NAME_MAX + 1];
+	memcpy(env_name, name, len);
+	env_name[len] = '\0';
+
+	return getenv(env_name);
+}
+
+const char *slash_var_get(struct slash *slash, const char *name)
+{
+	size_t len = strlen(name);
+	if (!slash_var_name_valid(name, len))
+		return NULL;
+
+	return slash_var_lookup(slash, name, len);
+}
+
+void slash_var_foreach(struct slash *slash, void (*func)(struct slash *slash, const char *name, const char *value))
+{
+	if (!slash->vars)
+		return;
+
+	for (unsigned int i = 0; i < slash->vars->size; i++) {
+		if (slash->vars->slots[i].name)
+			func(slash, slash->vars->slots[i].name, slash->vars->slots[i].value);
+	}
+}
+
+void slash_vars_free(struct slash *slash)
+{
+	if (!slash->vars)
+		return;
+
+	for (unsigned int i = 0; i < slash->vars->size; i++)
+		free(slash->vars->slots[i].name);
+	free(slash->vars->slots);
+	free(slash->vars);
+	slash->vars = NULL;
+}
+
+/* Where a reference to a variable in line ends, NULL when slash_expand() leaves the text at c as it is */
+static const char *slash_var_ref(const char *c, bool single_quote, const char **name, size_t *name_len)
+{
+	if (*c != '$' || single_quote)
+		return NULL;
+
+	const char *end;
+	*name = c + 1;
+	if (**name == '{') {
+		(*name)++;
+		const char *close = strchr(*name, '}');
+		*name_len = close ? (size_t) (close - *name) : 0;
+		end = close;
+	} else {
+		*name_len = 0;
+		while (isalnum((unsigned char) (*name)[*name_len]) || (*name)[*name_len] == '_')
+			(*name_len)++;
+		end = *name + *name_len - 1;
+	}
+
+	/* Unknown variables are left as they are, for slash_process_cmd_line_hook */
+	return slash_var_name_valid(*name, *name_len) ? end : NULL;
+}
+
+unsigned int slash_var_refs(const char *line, struct slash_var_ref *refs, unsigned int max)
+{
+	bool single_quote = false, double_quote = false;
+	unsigned int count = 0;
+
+	for (const char *c = line; *c; c++) {
+		if (*c == '\'' && !double_quote)
+			single_quote = !single_quote;
+		else if (*c == '\"' && !single_quote)
+			double_quote = !double_quote;
+
+		const char *name;
+		size_t name_len;
+		const char *end = slash_var_ref(c, single_quote, &name, &name_len);
+		if (!end)
+			continue;
+
+		if (count < max) {
+			refs[count].offset = c - line;
+			refs[count].length = end - c + 1;
+			refs[count].name_offset = name - line;
+			refs[count].name_length = name_len;
+		}
+		count++;
+		c = end;
+	}
+
+	return count;
+}
+
+const char *slash_var_value(struct slash *slash, const char *name, size_t len)
+{
+	return slash_var_lookup(slash, name, len);
+}
+
+/* Expand the variables of line into out, or only measure the result when out is NULL */
+static size_t slash_expand_into(struct slash *slash, const char *line, char *out, unsigned int *expansions)
+{
+	bool single_quote = false, double_quote = false;
+	size_t len = 0;
+
+	for (const char *c = line; *c; c++) {
+		if (*c == '\'' && !double_quote)
+			single_quote = !single_quote;
+		else if (*c == '\"' && !single_quote)
+			double_quote = !double_quote;
+
+		const char *name;
+		size_t name_len;
+		const char *end = slash_var_ref(c, single_quote, &name, &name_len);
+		const char *value = end ? slash_var_lookup(slash, name, name_len) : NULL;
+
+		if (value) {
+			size_t value_len = strlen(value);
+			(*expansions)++;
+			if (out)
+				memcpy(out + len, value, value_len);
+			len += value_len;
+			c = end;
+		} else {
+			if (out)
+				out[len] = *c;
+			len++;
+		}
+	}
+
+	if (out)
+		out[len] = '\0';
+
+	return len;
+}
+
+char *slash_expand(struct slash *slash, char *line)
+{
+	/* Nothing to expand, use the line as it is */
+	if (!strchr(line, '$'))
+		return line;
+
+	unsigned int expansions = 0;
+	size_t len = slash_expand_into(slash, line, NULL, &expansions);
+	if (expansions == 0)
+		return line;
+
+	char *expanded = slash_alloc(slash, len + 1);
+	if (!expanded)
+		return NULL;
+	slash_expand_into(slash, line, expanded, &expansions);
+
+	return expanded;
+}
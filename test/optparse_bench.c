@@ -0,0 +1,58 @@
+/* Benchmark of optparse_parse() for a command with many options */
+
+#include <slash/optparse.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_OPTIONS 40
+#define BENCH_ITERATIONS 200000
+
+static double bench_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char * argv[]) {
+
+	int iterations = argc > 1 ? atoi(argv[1]) : BENCH_ITERATIONS;
+
+	static char parser_buf[OPTPARSE_ARENA_SIZE(BENCH_OPTIONS)];
+	static char names[BENCH_OPTIONS][16];
+	static int values[BENCH_OPTIONS];
+
+	optparse_t * parser = optparse_new_arena(parser_buf, sizeof(parser_buf), "bench", "<args...>", NULL);
+
+	/* Options are added in reverse order, so a linear scan would find the common ones last */
+	for (int i = BENCH_OPTIONS - 1; i >= 0; i--) {
+		snprintf(names[i], sizeof(names[i]), "option-%02d", i);
+		int short_opt = i < 26 ? 'a' + i : 'A' + i - 26;
+		if (!optparse_add_int(parser, short_opt, names[i], "NUM", 0, &values[i], "benchmark option")) {
+			fprintf(stderr, "failed to add option %d\n", i);
+			return 1;
+		}
+	}
+
+	const char * args[] = {
+		"bench", "-a", "1", "-z7", "--option-05=5", "--option-39=39",
+		"--option-15=15", "-N", "13", "--option-20=20", "arg",
+	};
+	int nargs = sizeof(args) / sizeof(args[0]);
+
+	double start = bench_now();
+	for (int i = 0; i < iterations; i++) {
+		optparse_reset(parser);
+		if (optparse_parse(parser, nargs - 1, args + 1) < 0) {
+			fprintf(stderr, "parse failed\n");
+			return 1;
+		}
+	}
+	double elapsed = bench_now() - start;
+
+	printf("%d options, %d arguments: %.1f ns per parse\n",
+		   BENCH_OPTIONS, nargs - 1, elapsed * 1e9 / iterations);
+
+	return 0;
+}
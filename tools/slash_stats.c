@@ -0,0 +1,125 @@
+/* Monitor the command latencies of a running slash application, see slash_stats_open()
+ *
+ * Usage: slash_stats <shm name> [interval in ms]
+ */
+
+#include <slash/stats.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Duration at the given quantile, taken in the middle of the bucket */
+static uint64_t percentile(const uint64_t * buckets, uint64_t total, double quantile) {
+
+	uint64_t target = quantile * total;
+	uint64_t seen = 0;
+	for (unsigned int b = 0; b < SLASH_STATS_BUCKETS; b++) {
+		seen += buckets[b];
+		if (seen > target) {
+			if (b + 1 == SLASH_STATS_BUCKETS)
+				return slash_stats_bucket_low(b);
+			return (slash_stats_bucket_low(b) + slash_stats_bucket_low(b + 1)) / 2;
+		}
+	}
+
+	return 0;
+}
+
+static void print_us(uint64_t ns) {
+	printf(" %12.1f", ns / 1000.0);
+}
+
+static void print_stats(const struct slash_stats_header * header) {
+
+	printf("%-32s %10s %12s %12s %12s %12s\n", "command", "count", "mean us", "p50 us", "p99 us", "max us");
+
+	uint32_t count = atomic_load_explicit((_Atomic uint32_t *) &header->entry_count, memory_order_acquire);
+	if (count > header->max_entries)
+		count = header->max_entries;
+
+	for (uint32_t i = 0; i < count; i++) {
+		struct slash_stats_entry * entry = (struct slash_stats_entry *)
+			((char *) header + header->header_size + (size_t) i * header->entry_size);
+		if (!atomic_load_explicit(&entry->ready, memory_order_acquire))
+			continue;
+
+		/* The counters are sampled one by one, so they may disagree slightly */
+		uint64_t buckets[SLASH_STATS_BUCKETS];
+		uint64_t total = 0;
+		for (unsigned int b = 0; b < SLASH_STATS_BUCKETS; b++) {
+			buckets[b] = atomic_load_explicit(&entry->buckets[b], memory_order_relaxed);
+			total += buckets[b];
+		}
+		uint64_t calls = atomic_load_explicit(&entry->count, memory_order_relaxed);
+		uint64_t total_ns = atomic_load_explicit(&entry->total_ns, memory_order_relaxed);
+		uint64_t max_ns = atomic_load_explicit(&entry->max_ns, memory_order_relaxed);
+
+		printf("%-32.*s %10llu", SLASH_STATS_NAME_SIZE, entry->name, (unsigned long long) calls);
+		print_us(calls ? total_ns / calls : 0);
+		print_us(slash_min(percentile(buckets, total, 0.50), max_ns));
+		print_us(slash_min(percentile(buckets, total, 0.99), max_ns));
+		print_us(max_ns);
+		printf("\n");
+	}
+
+	uint32_t overflow = atomic_load_explicit((_Atomic uint32_t *) &header->overflow, memory_order_relaxed);
+	if (overflow > 0)
+		printf("%u executions not recorded, more than %u different commands\n", overflow, header->max_entries);
+}
+
+int main(int argc, char * argv[]) {
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <shm name> [interval in ms]\n", argv[0]);
+		return 1;
+	}
+
+	int interval = argc > 2 ? atoi(argv[2]) : 0;
+
+	int fd = shm_open(argv[1], O_RDONLY, 0);
+	if (fd < 0) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(struct slash_stats_header)) {
+		fprintf(stderr, "%s: not a slash stats segment\n", argv[1]);
+		close(fd);
+		return 1;
+	}
+
+	const struct slash_stats_header * header = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (header == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	if (header->magic != SLASH_STATS_MAGIC || header->version != SLASH_STATS_VERSION ||
+		header->entry_size != sizeof(struct slash_stats_entry) || header->bucket_count != SLASH_STATS_BUCKETS ||
+		SLASH_STATS_SIZE(0) + (size_t) header->max_entries * header->entry_size > (size_t) st.st_size) {
+		fprintf(stderr, "%s: unsupported layout (version %u, this tool reads version %u)\n",
+				argv[1], header->version, SLASH_STATS_VERSION);
+		return 1;
+	}
+
+	printf("pid %d\n", header->pid);
+	while (1) {
+		print_stats(header);
+		if (interval <= 0)
+			break;
+
+		struct timespec ts = { .tv_sec = interval / 1000, .tv_nsec = (interval % 1000) * 1000000L };
+		nanosleep(&ts, NULL);
+		printf("\n");
+	}
+
+	return 0;
+}
@@ -0,0 +1,229 @@
+#!/usr/bin/env python3
+# encoding: utf-8
+"""
+Generate a const, sorted and perfect hashed slash command table for static builds.
+
+The commands are read from the "slash" section of a first link of the application,
+the generated C file is then linked into the final application, which makes
+slash_list_init() use the table instead of registering the commands at boot.
+
+Usage: slash_table_gen.py <linked ELF> <output.c>
+"""
+
+import struct
+import sys
+
+SECTION = 'slash'
+
+SHT_SYMTAB = 2
+SHT_RELA = 4
+SHT_NOBITS = 8
+SHT_REL = 9
+ET_REL = 1
+SHF_ALLOC = 0x2
+STB_LOCAL = 0
+STT_OBJECT = 1
+
+
+def slash_table_hash(name, seed):
+    """ Must match slash_table_hash() in src/slash_list.c """
+    h = 2166136261 ^ seed
+    for c in name:
+        h ^= c
+        h = (h * 16777619) & 0xffffffff
+    h ^= h >> 16
+    h = (h * 0x85ebca6b) & 0xffffffff
+    h ^= h >> 13
+    h = (h * 0xc2b2ae35) & 0xffffffff
+    h ^= h >> 16
+    return h
+
+
+class Elf:
+    def __init__(self, data):
+        if data[:4] != b'\x7fELF':
+            raise ValueError('not an ELF file')
+        self.data = data
+        self.is64 = data[4] == 2
+        self.endian = '<' if data[5] == 1 else '>'
+        self.addends = None
+
+        if self.is64:
+            (self.type, shoff, shentsize, shnum, shstrndx) = self.unpack('H22xQ10xHHH', 16)
+        else:
+            (self.type, shoff, shentsize, shnum, shstrndx) = self.unpack('H14xI10xHHH', 16)
+
+        self.sections = []
+        for i in range(shnum):
+            off = shoff + i * shentsize
+            if self.is64:
+                name, typ, flags, addr, offset, size, link, info, align, entsize = self.unpack('IIQQQQIIQQ', off)
+            else:
+                name, typ, flags, addr, offset, size, link, info, align, entsize = self.unpack('IIIIIIIIII', off)
+            self.sections.append(dict(name=name, type=typ, flags=flags, addr=addr, offset=offset,
+                                      size=size, link=link, entsize=entsize))
+
+        strtab = self.sections[shstrndx]
+        for sec in self.sections:
+            sec['name'] = self.cstring(strtab['offset'] + sec['name'])
+
+        if self.type == ET_REL:
+            raise ValueError('relocatable object, the table is generated from a linked executable')
+        for sec in self.sections:
+            # The addend of REL is stored in place and combined with the symbol, which is not resolved here
+            if sec['type'] == SHT_REL and sec['flags'] & SHF_ALLOC and sec['size'] > 0:
+                raise ValueError('REL relocations (%s) are not supported, only RELA' % sec['name'].decode())
+
+    def unpack(self, fmt, offset):
+        return struct.unpack_from(self.endian + fmt, self.data, offset)
+
+    def cstring(self, offset):
+        return self.data[offset:self.data.index(b'\0', offset)]
+
+    def section(self, name):
+        for i, sec in enumerate(self.sections):
+            if sec['name'] == name:
+                return i, sec
+        return None, None
+
+    def symbols(self):
+        for sec in self.sections:
+            if sec['type'] != SHT_SYMTAB:
+                continue
+            strtab = self.sections[sec['link']]
+            for off in range(sec['offset'], sec['offset'] + sec['size'], sec['entsize']):
+                if self.is64:
+                    name, info, other, shndx, value, size = self.unpack('IBBHQQ', off)
+                else:
+                    name, value, size, info, other, shndx = self.unpack('IIIBBH', off)
+                yield dict(name=self.cstring(strtab['offset'] + name).decode(), bind=info >> 4,
+                           type=info & 0xf, shndx=shndx, value=value, size=size)
+
+    def relocated(self, addr):
+        """ Address stored at addr, applying RELA relocations of position independent executables """
+        if self.addends is None:
+            self.addends = {}
+            for sec in self.sections:
+                if sec['type'] != SHT_RELA or not sec['flags'] & SHF_ALLOC:
+                    continue
+                for off in range(sec['offset'], sec['offset'] + sec['size'], sec['entsize']):
+                    if self.is64:
+                        r_offset, r_info, r_addend = self.unpack('QQq', off)
+                    else:
+                        r_offset, r_info, r_addend = self.unpack('IIi', off)
+                    self.addends[r_offset] = r_addend
+        if addr in self.addends:
+            return self.addends[addr]
+        return self.unpack('Q' if self.is64 else 'I', self.file_offset(addr))[0]
+
+    def file_offset(self, addr):
+        for sec in self.sections:
+            if sec['flags'] & SHF_ALLOC and sec['type'] != SHT_NOBITS and \
+                    sec['addr'] <= addr < sec['addr'] + sec['size']:
+                return sec['offset'] + addr - sec['addr']
+        raise ValueError('address 0x%x is not in the file' % addr)
+
+
+def read_commands(path):
+    with open(path, 'rb') as f:
+        elf = Elf(f.read())
+
+    index, sec = elf.section(SECTION.encode())
+    if sec is None:
+        raise ValueError('%s has no "%s" section' % (path, SECTION))
+
+    symbols = []
+    for sym in elf.symbols():
+        if sym['shndx'] != index or sym['type'] != STT_OBJECT or sym['size'] == 0:
+            continue
+        if sym['bind'] == STB_LOCAL:
+            raise ValueError('command %s is static and cannot be referenced by the table' % sym['name'])
+        symbols.append(sym)
+
+    # In section order, the last of duplicate names wins like when slash_list_init() registers them
+    commands = {}
+    for sym in sorted(symbols, key=lambda sym: sym['value']):
+        name = elf.cstring(elf.file_offset(elf.relocated(sym['value'])))
+        if name in commands:
+            print('%s: duplicate command "%s", using %s instead of %s' %
+                  (sys.argv[0], name.decode(), sym['name'], commands[name]), file=sys.stderr)
+        commands[name] = sym['name']
+
+    return commands
+
+
+def perfect_hash(names):
+    """ Hash and displace: every bucket gets a seed which maps its names to free slots """
+    count = len(names)
+    bucket_count = max(1, (count + 3) // 4)
+    buckets = [[] for _ in range(bucket_count)]
+    for i, name in enumerate(names):
+        buckets[slash_table_hash(name, 0) % bucket_count].append(i)
+
+    slots = [None] * count
+    seeds = [0] * bucket_count
+    for b in sorted(range(bucket_count), key=lambda b: -len(buckets[b])):
+        if not buckets[b]:
+            continue
+        seed = 1
+        while True:
+            pos = [slash_table_hash(names[i], seed) % count for i in buckets[b]]
+            if len(set(pos)) == len(pos) and all(slots[p] is None for p in pos):
+                break
+            seed += 1
+        seeds[b] = seed
+        for i, p in zip(buckets[b], pos):
+            slots[p] = i
+
+    return seeds, slots
+
+
+def generate(commands, out):
+    names = sorted(commands)
+    if len(names) > 0xffff:
+        raise ValueError('too many commands')
+    seeds, slots = perfect_hash(names)
+
+    out.write('/* Generated by slash_table_gen.py, do not edit */\n\n')
+    out.write('#include <slash/table.h>\n\n')
+    for name in names:
+        out.write('extern const struct slash_command %s;\n' % commands[name])
+
+    out.write('\nstatic struct slash_command * const slash_table_commands[] = {\n')
+    for name in names:
+        out.write('\t(struct slash_command *) &%s, /* %s */\n' % (commands[name], name.decode()))
+    if not names:
+        out.write('\tNULL,\n')
+    out.write('};\n\n')
+
+    out.write('static const uint32_t slash_table_seeds[] = {%s};\n\n' % (', '.join(str(s) for s in seeds) or '0'))
+    out.write('static const uint16_t slash_table_slots[] = {%s};\n\n' % (', '.join(str(s) for s in slots) or '0'))
+
+    out.write('const struct slash_table slash_static_table = {\n')
+    out.write('\t.count = %d,\n' % len(names))
+    out.write('\t.bucket_count = %d,\n' % len(seeds))
+    out.write('\t.commands = slash_table_commands,\n')
+    out.write('\t.seeds = slash_table_seeds,\n')
+    out.write('\t.slots = slash_table_slots,\n')
+    out.write('};\n')
+
+
+def main():
+    if len(sys.argv) != 3:
+        print(__doc__.strip(), file=sys.stderr)
+        return 1
+
+    try:
+        commands = read_commands(sys.argv[1])
+    except (OSError, ValueError) as e:
+        print('%s: %s' % (sys.argv[0], e), file=sys.stderr)
+        return 1
+
+    with open(sys.argv[2], 'w') as out:
+        generate(commands, out)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+# encoding: utf-8
+"""
+Print an execution trace written by slash_trace_dump() or "trace dump <file>".
+
+Usage: slash_trace_decode.py <trace file>
+"""
+
+import datetime
+import struct
+import sys
+
+MAGIC = 0x52544c53
+VERSION = 2
+
+# Record flags
+RUNNING = 0x1
+
+HEADER = struct.Struct('<IIIIIIqQ')
+RECORD = struct.Struct('<QQiHHII')
+
+# Command of a record when all command ids were in use
+NO_COMMAND = 0xffff
+
+
+def decode(data, out):
+    if len(data) < HEADER.size:
+        raise ValueError('file too short')
+
+    magic, version, header_size, record_size, name_size, name_count, offset, total = HEADER.unpack_from(data)
+    if magic != MAGIC:
+        raise ValueError('not a slash trace')
+    if version != VERSION or record_size != RECORD.size:
+        raise ValueError('unsupported trace version %d' % version)
+
+    pos = header_size
+    names = []
+    for _ in range(name_count):
+        names.append(data[pos:pos + name_size].split(b'\0', 1)[0].decode(errors='replace'))
+        pos += name_size
+
+    count = (len(data) - pos) // record_size
+    overflow = sum(1 for i in range(count) if RECORD.unpack_from(data, pos + i * record_size)[3] == NO_COMMAND)
+    out.write('# %d commands traced, last %d in this file\n' % (total, count))
+    if overflow:
+        out.write('# %d records of commands beyond the first %d, shown as ?\n' % (overflow, name_count))
+    out.write('# %-24s %-32s %12s %6s %8s\n' % ('time', 'command', 'duration us', 'ret', 'args'))
+
+    for i in range(count):
+        timestamp, duration, ret, command, flags, digest, _ = RECORD.unpack_from(data, pos + i * record_size)
+        time = datetime.datetime.fromtimestamp((timestamp + offset) / 1e9)
+        name = names[command] if command < len(names) else '?'
+        if flags & RUNNING:
+            out.write('%-26s %-32s %12s %6s %08x\n' % (time.strftime('%Y-%m-%d %H:%M:%S.%f'), name,
+                                                       'running', '', digest))
+        else:
+            out.write('%-26s %-32s %12.1f %6d %08x\n' % (time.strftime('%Y-%m-%d %H:%M:%S.%f'), name,
+                                                         duration / 1e3, ret, digest))
+
+
+def main():
+    if len(sys.argv) != 2:
+        print(__doc__.strip(), file=sys.stderr)
+        return 1
+
+    try:
+        with open(sys.argv[1], 'rb') as f:
+            decode(f.read(), sys.stdout)
+    except (OSError, ValueError) as e:
+        print('%s: %s' % (sys.argv[0], e), file=sys.stderr)
+        return 1
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())